@@ -1,12 +1,31 @@
+#define _GNU_SOURCE // pthread_setaffinity_np, pipe2
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <poll.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
+// AVX2 kernels are compiled in on x86-64 whatever the -m flags, and used
+// when the CPU has AVX2 (see initBitboards)
+#ifdef __x86_64__
+#include <immintrin.h>
+#define HAVE_AVX2
+#endif
+
 #define REPOS_CURSOR "\x1b[1;1H"
 #define CLEAR_SCREEN "\x1b[2J"
 #define HIDE_CURSOR "\033[?25l"
@@ -18,14 +37,123 @@
 #define COLOR_GREEN_BOLD "\x1b[1;32m"
 #define COLOR_BLACK_ON_WHITE "\x1b[30;47m"
 
+// Board size and the line length that wins. The default variant is 10x10,
+// four in a row; the others are this file built again with different values
+// (see VARIANT_LIST).
+#ifndef N
 #define N 10
+#endif
+#ifndef M
 #define M 10
+#endif
+#ifndef WIN_LENGTH
+#define WIN_LENGTH 4
+#endif
+#define STRINGIFY_(x) #x
+#define STRINGIFY(x) STRINGIFY_(x)
+#define VARIANT_NAME STRINGIFY(N) "x" STRINGIFY(M) "x" STRINGIFY(WIN_LENGTH)
+
+// Variants linked into the default build besides itself, as rows, columns,
+// line length. Each is game.c compiled again with those values and
+// -DVARIANT_ENTRY=main_<rows>x<cols>x<length>, with every symbol but the
+// entry point made local (see the Makefile, which lists the same variants).
+#define VARIANT_LIST(X) X(15, 15, 5) X(7, 7, 4)
 #define INPUT_BUF_LEN 10
+#define FRAME_LINES 48
+#define FRAME_LINE_LEN 512
+#define PROGRESS_MS 100 // Redraw interval of the live search progress
 
 #define MULTIPLIER_IN_A_ROW 2
-#define NUM_THREADS 8
-#define MAX_MOVES 100
+#define MAX_THREADS 1024
+#define CACHE_LINE 64
+#define MAX_MOVES (N * M)
+#define MAX_PLY 64
+#define MAX_DEPTH (MAX_PLY - 4) // Iterative deepening cap under --movetime
+#define ASPIRATION_WINDOW 25
+#define WIN_SCORE 30000 // Win at the root; a win n plies away scores n less
+#define INF_SCORE 32000
+#define LMR_MIN_DEPTH 3 // Shallower nodes are searched without reductions
+#define LMR_MIN_MOVES 3 // Moves searched at full depth before reducing
+#define HISTORY_MAX (1 << 20) // History scores are halved past this
+#define THREAT_MAX_DEPTH 16     // Attacker moves in one forced line
+#define THREAT_NODES 20000      // Budget of one threat-space search
+#define THREAT_DEFENSE_NODES 2000 // Budget to refute one defending move
+#define SPLIT_MIN_DEPTH 2 // Shallower nodes are not worth sharing
+#define DEQUE_SIZE 1024   // Per-thread work-stealing deque capacity
+#define IDLE_SPINS 64     // Failed steals before an idle worker sleeps
 #define DEFAULT_DEPTH 6
+#define DEFAULT_HASH_MB 16
+#define DEFAULT_RADIUS 2
+#define BENCH_DEPTH 8
+#define MATCH_GAMES 200
+#define SELFTEST_GAMES (1000000 / (N * M * N * M)) // Cost grows as cells^2
+#define MATCH_OPENING_PLIES 4    // Match games start from this many stones
+#define MATCH_OPENING_AREA 6     // in the middle AREA x AREA cells
+#define MATCH_OPENING_TRIES 1000 // Draws before an opening may repeat
+#define BOOK_PLIES 8   // Opening book: plies from the empty board it covers,
+#define BOOK_WIDTH 4   // replies followed at each of the opponent's turns
+#define BOOK_DEPTH 10  // and the depth its moves are searched to
+#define BOOK_VERSION 1 // Bump when the file layout or the keys change
+#define CACHE_ENTRIES (1 << 18) // Root results the search cache file holds
+#define CACHE_BUCKET_SIZE 4
+#define CACHE_VERSION 3 // Bump when a search change makes old results stale
+#define MCTS_NODES (1 << 21)   // Tree nodes preallocated for --mcts
+#define MCTS_EXPLORATION 0.7   // UCT exploration constant
+#define MCTS_EXPAND_VISITS 2   // Visits of a leaf before it is expanded
+// Playouts standing in for a depth limit; a playout costs about one move per
+// cell
+#define MCTS_PLAYOUTS(depth) ((500LL << (depth)) * 100 / (N * M))
+#define MCTS_REPORT_MS 100     // Interval of progress reports
+#define TRACE_RING_SIZE 4096 // Records per thread between two writes
+#define TRACE_MAX_RINGS 256  // Threads that can trace at once
+#define TRACE_FLUSH_MS 100   // Interval of background trace writes
+#define TRACE_VERSION 1      // Bump when the records or events change
+
+// Bitboard layout: cell (x, y) lives at bit x * CELL_STRIDE + y. Every row
+// carries one always-empty sentinel column so that shifting a row sideways
+// never wraps into its neighbour, which keeps the line tests below branchless.
+#define CELL_STRIDE (M + 1)
+#define CELLS (N * CELL_STRIDE)
+#define CELL(x, y) ((x) * CELL_STRIDE + (y))
+
+// Shift distances for the four line directions, in the order the heuristic
+// walks them: horizontal, vertical, diagonal down-right, diagonal down-left
+#define DIR_H 1
+#define DIR_V CELL_STRIDE
+#define DIR_DR (CELL_STRIDE + 1)
+#define DIR_DL (CELL_STRIDE - 1)
+
+#if CELLS <= 128
+__extension__ typedef unsigned __int128 Bitboard;
+#define BB_NONE ((Bitboard)0)
+#else
+// Bigger boards use as many 64-bit words as the cells need. The bb*
+// helpers below hide the difference, so both compile to straight-line code.
+#define BB_WORDS ((CELLS + 63) / 64)
+typedef struct Bitboard {
+  uint64_t w[BB_WORDS];
+} Bitboard;
+#define BB_NONE ((Bitboard){{0}})
+#endif
+
+// Lines of cells along one direction: at most MAX_LINES per direction,
+// each at most MAX_LINE long
+#define MAX_LINE (N > M ? N : M)
+#define MAX_LINES (N + M - 1)
+#define LINE_BUF 32 // Cells of a line plus padding for 16-lane loads
+#define LINE_TABLE_MAX 10 // Longer lines are scored when they change
+
+// Dihedral symmetries of the board: all 8 when square, else the 4 that keep
+// the rows/columns shape (identity, half turn and the two mirrors)
+#define SYMMETRIES (N == M ? 8 : 4)
+
+// Transposition table bound types
+#define BOUND_NONE 0
+#define BOUND_EXACT 1
+#define BOUND_LOWER 2 // Search failed high: score is a lower bound
+#define BOUND_UPPER 3 // Search failed low: score is an upper bound
+#define NO_MOVE 0xFF
+#define TT_BUCKET_SIZE 4 // 4 x 16 byte entries = one cache line
 
 struct termios origterm;
 
@@ -33,6 +161,186 @@ typedef struct Pos {
   int x, y;
 } Pos;
 
+// Search board: one mask per player, stones[0] = human (1), stones[1] = AI (2)
+// hash[s] is the Zobrist hash of the board seen through symmetry s, so
+// hash[0] is the plain hash and the minimum is the canonical one.
+// score is the heuristic of assignScoreToGrid(), kept up to date line by
+// line: line l of direction d reads lineCodes[d][l] in base 3 (0 empty, 1
+// or 2 a stone of side 0 or 1, first cell lowest) and adds
+// lineScores[d][l]. An all-zero Board is the empty board.
+typedef struct Board {
+  Bitboard stones[2];
+  uint64_t hash[SYMMETRIES];
+  int score;
+  uint32_t lineCodes[4][MAX_LINES];
+  int16_t lineScores[4][MAX_LINES];
+} Board;
+
+// Transposition table entry. The key is stored XORed with the data, so a
+// torn write from a concurrent store fails verification instead of being
+// mistaken for a hit; no locks are needed.
+typedef struct TTEntry {
+  _Atomic uint64_t key;
+  _Atomic uint64_t data;
+} TTEntry;
+
+typedef struct TTBucket {
+  TTEntry entries[TT_BUCKET_SIZE];
+} TTBucket;
+
+typedef struct TranspositionTable {
+  TTBucket *buckets;
+  uint64_t mask; // Bucket count - 1 (count is a power of two)
+  uint8_t generation;
+} TranspositionTable;
+
+// Decoded transposition table entry
+typedef struct TTData {
+  int score;
+  int depth;
+  int bound;
+  int move; // Cell index or NO_MOVE
+} TTData;
+
+// What to search for: depth and time limits, and an optional callback run
+// after every completed iteration
+struct SearchResult;
+typedef struct SearchLimits {
+  int depth;      // Deepest iteration; 0 = until stopped or out of time
+  int moveTimeMs; // Time budget; 0 = none
+  void (*report)(const struct SearchResult *result);
+  int keepGeneration; // One of a series of searches of the same move
+                      // (pondering): don't age the TT or the history
+} SearchLimits;
+
+typedef struct SearchResult {
+  int cell;  // Best move, or NO_MOVE when there is none
+  int score; // From the side to move's point of view
+  int depth; // Last completed iteration (0: found without searching)
+  uint64_t nodes;
+  long long timeMs;
+} SearchResult;
+
+// Command line settings, applied by setup() on every (re)start
+typedef struct Options {
+  int threads; // Search threads; 0 = one per online CPU
+  int pin;     // Pin worker i to CPU i
+  int searchDepth;
+  int moveTimeMs; // Per-move time budget; 0 = fixed adaptive depth
+  int hashMb;
+  int symmetry; // Merge mirrored/rotated positions in the TT
+  int radius;   // Candidate moves lie within this distance of a stone
+  FILE *statsFile; // One JSON line of search statistics per search
+  int noSimd;      // Use the scalar kernels even if the CPU has AVX2
+  int ponder;      // Search the replies to the human's moves on their time
+  int mcts;        // Monte Carlo tree search instead of alpha-beta
+} Options;
+
+// Search statistics, kept per thread and summed over the pool by
+// threadPool_stats(). Compile with -DNO_STATS to leave out the counting.
+typedef struct SearchStats {
+  uint64_t nodes;
+  uint64_t leaves;       // Heuristic evaluations at the horizon
+  uint64_t cutoffs;      // Beta cutoffs
+  uint64_t firstCutoffs; // Beta cutoffs by the first move searched
+  uint64_t ttProbes;
+  uint64_t ttHits;    // Probes that found the position
+  uint64_t ttCutoffs; // Hits whose bound ended the node
+  uint64_t plyNodes[MAX_PLY]; // Nodes that searched moves, by ply
+  uint64_t plyMoves[MAX_PLY]; // Moves searched, by ply
+  uint64_t rootUs[CELLS];     // Time spent on each root move
+} SearchStats;
+
+#ifdef NO_STATS
+#define STAT_ADD(thread, field, n) ((void)0)
+#else
+#define STAT_ADD(thread, field, n) ((thread)->stats.field += (n))
+#endif
+#define STAT_INC(thread, field) STAT_ADD(thread, field, 1)
+
+// Trace events: name, phase as in Chrome's trace format (B and E begin and
+// end a span on the thread's timeline, i is an instant, M is metadata) and
+// the names of up to five arguments. Arguments called cell are decoded as
+// moves.
+#define TRACE_EVENT_LIST(X)                                                    \
+  X(CLOCK, "clock", 'M', "")                                                  \
+  X(DROPPED, "dropped", 'i', "records")                                       \
+  X(WORKER, "worker", 'M', "id")                                              \
+  X(SEARCH_BEGIN, "search", 'B', "depth,moveTimeMs")                          \
+  X(SEARCH_END, "search", 'E', "cell,score,depth")                            \
+  X(DEPTH_BEGIN, "depth", 'B', "depth")                                       \
+  X(DEPTH_END, "depth", 'E', "depth,cell,score,completed")                    \
+  X(ASPIRATION, "aspiration re-search", 'i', "depth,alpha,beta")              \
+  X(ROOT_MOVE, "root move", 'i', "cell,score")                                \
+  X(WIN, "winning move", 'i', "cell")                                         \
+  X(FORCED_WIN, "forced win", 'i', "cell,nodes")                              \
+  X(FORCED_LINE, "opponent forced line", 'i', "defenses")                     \
+  X(CACHED, "cached result", 'i', "cell,depth")                               \
+  X(MCTS_RESULT, "mcts result", 'i', "cell,score,visits,nodes")               \
+  X(ROOT_BEGIN, "root", 'B', "depth")                                         \
+  X(ROOT_END, "root", 'E', "")                                                \
+  X(HELP_BEGIN, "help", 'B', "ply,depth")                                     \
+  X(HELP_END, "help", 'E', "")                                                \
+  X(SLEEP_BEGIN, "sleep", 'B', "")                                            \
+  X(SLEEP_END, "sleep", 'E', "")                                              \
+  X(MCTS_BEGIN, "mcts", 'B', "")                                              \
+  X(MCTS_END, "mcts", 'E', "")                                                \
+  X(AI_BEGIN, "ai move", 'B', "moveNo")                                       \
+  X(AI_END, "ai move", 'E', "cell,depth")                                     \
+  X(BOOK, "book move", 'i', "cell,depth")                                     \
+  X(PONDERED, "pondered reply", 'i', "depth")                                 \
+  X(GAME_OVER, "game over", 'i', "winner")
+
+#define TRACE_ENUM(id, name, phase, args) TRACE_##id,
+enum { TRACE_EVENT_LIST(TRACE_ENUM) TRACE_EVENTS };
+
+// One trace record: 32 bytes, as written to the file
+typedef struct TraceRecord {
+  uint64_t time;   // traceClock() ticks
+  uint16_t event;  // TRACE_*
+  uint16_t thread; // Ring it was recorded in, one per live thread
+  int32_t args[5];
+} TraceRecord;
+
+// Records of one thread. Only the owner writes head and only the writer
+// thread writes tail, so recording takes no lock; a full ring drops
+// records and counts them instead of waiting.
+typedef struct TraceRing {
+  _Alignas(CACHE_LINE) _Atomic uint64_t head;
+  _Alignas(CACHE_LINE) _Atomic uint64_t tail;
+  atomic_uint dropped;
+  atomic_int inUse; // Owned by a live thread
+  int id;
+  TraceRecord records[TRACE_RING_SIZE];
+} TraceRing;
+
+typedef struct TraceHeader {
+  char magic[8];      // "ZGTRACE"
+  uint32_t version;   // TRACE_VERSION
+  uint32_t variant;   // N << 16 | M << 8 | WIN_LENGTH, for the cells
+  uint32_t recordSize;
+} TraceHeader;
+
+typedef struct Tracer {
+  atomic_int enabled;
+  FILE *file;
+  pthread_key_t key; // Releases a thread's ring when it exits
+  pthread_t writer;
+  pthread_mutex_t lock; // Guards the two flags below
+  pthread_cond_t wake;
+  int flush, stop;
+  _Atomic(TraceRing *) rings[TRACE_MAX_RINGS];
+  atomic_int ringCount;
+} Tracer;
+
+// Record an event with up to five integer arguments, if --trace is on
+#ifdef NO_TRACE
+#define TRACE(...) ((void)0)
+#else
+#define TRACE(...) TRACE_ARGS(__VA_ARGS__, 0, 0, 0, 0, 0, 0)
+#endif
+#define TRACE_ARGS(event, a, b, c, d, e, ...) traceEvent(event, a, b, c, d, e)
+
 typedef struct Game {
   int grid[N][M];
   char input[INPUT_BUF_LEN];
@@ -43,68 +351,413 @@ typedef struct Game {
   int aiThinking;
   Pos aiMove;
   int searchDepth;
+  int aiDepth;        // Depth completed by the last AI search
+  long long aiTimeMs; // Time spent by the last AI search
+  SearchStats aiStats; // Statistics of the last AI search
+  int aiPondered;      // The last AI move was found while the human thought
+  int aiBooked;        // The last AI move came from the opening book
+  int winMark[N][M];   // Cells of the winning line, kept by gridChanged()
 } Game;
 
-// Structure for move evaluation task
-typedef struct MoveTask {
-  int grid[N][M]; // Grid state after this move
-  Pos move;       // The move position
-  int score;      // Result score (filled by worker)
-  int completed;  // Flag indicating task is done
-} MoveTask;
+// One screenful of text, line by line, escape sequences included
+typedef struct Frame {
+  char lines[FRAME_LINES][FRAME_LINE_LEN];
+  int count;
+} Frame;
+
+// Structure for move ordering in the search
+typedef struct ScoredMove {
+  int cell;
+  int score;
+} ScoredMove;
+
+// Young Brothers Wait split point: a node whose eldest move has been
+// searched and whose remaining moves are shared between the owner and any
+// helpers that join. Lives in the owner's SearchThread until all helpers
+// have left (refs == 0).
+typedef struct SplitPoint {
+  _Alignas(CACHE_LINE) // Owners' split points never share a line
+  // Enclosing split point, for cutoff checks. Atomic because thieves may
+  // follow the chain of a stale ticket while its owner reuses it.
+  struct SplitPoint *_Atomic parent;
+  Board board;               // Position at the split node
+  Bitboard candidates;       // Candidate cells at the split node
+  int ply, depth, side;
+  ScoredMove *moves;         // All moves of the node; helpers write back scores
+  int moveCount;
+
+  pthread_mutex_t lock; // Guards the fields below
+  int nextMove;        // Moves before this one are taken (set by the owner)
+  int alpha, beta;     // Window shared by everyone working here
+  int best, bestCell;
+  atomic_int cutoff;   // Bound crossed: everyone below here can stop
+  atomic_int refs;     // Unclaimed tickets + helpers still working
+} SplitPoint;
+
+// Chase-Lev work-stealing deque of split point tickets. The owner pushes
+// and pops at the bottom, thieves steal from the top (oldest, so the
+// largest remaining subtrees).
+typedef struct WorkDeque {
+  _Alignas(CACHE_LINE) atomic_long top; // Written by thieves
+  _Alignas(CACHE_LINE) atomic_long bottom; // Written by the owner only
+  SplitPoint *_Atomic items[DEQUE_SIZE];
+} WorkDeque;
+
+// Per-ply scratch space, so the search never allocates or copies boards
+typedef struct SearchStack {
+  Bitboard candidates; // Cells near a stone (may include occupied ones)
+  ScoredMove moves[MAX_MOVES];
+  int killers[2]; // Last two moves that caused a cutoff at this ply
+} SearchStack;
+
+// Move picker stages: the moves most likely to cut off come first, and the
+// rest are only scored once those have failed
+enum {
+  STAGE_TT,       // Best move stored in the transposition table
+  STAGE_BLOCKS,   // Cells where the opponent would win next move
+  STAGE_KILLERS,  // Killer moves of this ply
+  STAGE_GENERATE, // Score the remaining moves by history
+  STAGE_QUIET,    // Best remaining move by history, picked lazily
+  STAGE_DONE
+};
+
+// Staged, lazy move generation for one node. Moves are written to moves[]
+// in the order they are returned.
+typedef struct MovePicker {
+  int stage;
+  int side;
+  int ttMove;
+  const int *killers;
+  Bitboard todo;   // Cells not returned yet
+  Bitboard blocks; // Pending cells of STAGE_BLOCKS
+  ScoredMove *moves;
+  int count; // Moves returned so far
+  int end;   // End of the scored remaining moves
+} MovePicker;
 
-// Thread pool structures
+// Per-worker search state: one board updated in place by make/unmake.
+// Cache line aligned so that neighbouring workers never share a line.
+typedef struct SearchThread {
+  _Alignas(CACHE_LINE) int id;
+  uint64_t rng;              // Victim selection when stealing
+  uint64_t nodes;            // Nodes searched in the current search
+  Board board;
+  SplitPoint *activeSplit;   // Innermost split point this thread works under
+  WorkDeque deque;
+  SearchStack stack[MAX_PLY];
+  int history[2][CELLS]; // [side][cell]: how often the move cut off, by depth
+  SearchStats stats;
+  SplitPoint splitPoints[MAX_PLY]; // Split points owned by this thread
+} SearchThread;
+
+// Thread pool structures. Worker 0 runs each root search; the others look
+// for split point tickets in everyone's deques while a search is running.
 typedef struct ThreadPool {
-  pthread_t threads[NUM_THREADS];
+  int threadCount;
+  pthread_t *threads;
+  SearchThread *workers; // Cache line aligned array of threadCount
   pthread_mutex_t mutex;
   pthread_cond_t work_available;
   pthread_cond_t work_done;
-  MoveTask *tasks[MAX_MOVES];
-  int task_count;
-  int next_task;
-  int active_threads;
+  Board root;                     // Position of the pending root search
+  ScoredMove rootMoves[MAX_MOVES]; // Root moves, scores filled by the search
+  int rootMoveCount;
+  int side;               // Side to move at the root
+  int depth, alpha, beta; // Current iteration's depth and root window
+  int bestCell, bestScore; // Result of the last root search
+  int jobPending;         // Root search submitted, not yet picked up
+  int mcts;               // The search is a tree search (mctsWorker)
   int shutdown;
+
+  // Read on every node by every worker: kept apart from the counters below,
+  // which every split and steal writes
+  _Alignas(CACHE_LINE) atomic_int stop; // Set to abort the running search
+  atomic_int searching;                 // A root search is running
+  _Alignas(CACHE_LINE) atomic_int idle; // Workers currently looking for work
+  _Alignas(CACHE_LINE) atomic_uint workEpoch; // Bumped when tickets are pushed
+  atomic_int sleepers;
+
+  // Idle workers sleep here between searches' bursts of split points
+  pthread_mutex_t idle_mutex;
+  pthread_cond_t idle_cond;
 } ThreadPool;
 
 Game *game;
-FILE *logfile;
+Tracer tracer;
+_Thread_local TraceRing *traceRing; // This thread's, once it traced
+Frame frame;       // Being drawn
+Frame screen;      // What the terminal shows
+int screenValid;   // screen matches the terminal
+int wakeupFds[2] = {-1, -1}; // Search threads wake the UI loop through this
+volatile sig_atomic_t quitRequested;
 ThreadPool *pool;
+TranspositionTable tt;
+Options opts = {0,  0, DEFAULT_DEPTH, 0, DEFAULT_HASH_MB, 0, DEFAULT_RADIUS,
+                NULL, 0, 0, 0};
+
+static const int lineDirs[4] = {DIR_H, DIR_V, DIR_DR, DIR_DL};
+Bitboard boardMask; // All playable cells (sentinel column cleared)
+Bitboard neighborhood[CELLS]; // Cells within opts.radius of each cell
+int useAvx2;                  // Pick the AVX2 kernels
+
+// The lines of each direction, as the heuristic walks them: line l of
+// direction d holds lineCells[d][l][0..lineLength[d][l]), and cell c is at
+// index linePos[d][c] of line lineOf[d][c]
+int lineCount[4];
+int lineLength[4][MAX_LINES];
+int lineCells[4][MAX_LINES][MAX_LINE];
+int lineOf[4][CELLS];
+int linePos[4][CELLS];
+uint32_t pow3[MAX_LINE + 1];
+// lineTable[length][code]: score of every line up to LINE_TABLE_MAX cells
+int16_t *lineTable[LINE_TABLE_MAX + 1];
+
+// zobrist[side][cell][s]: key of a stone at cell as seen through symmetry s,
+// laid out so one move updates all symmetric hashes from one cache line
+uint64_t zobrist[2][CELLS][SYMMETRIES];
+int symCell[SYMMETRIES][CELLS];    // Cell mapped through symmetry s
+int symCellInv[SYMMETRIES][CELLS]; // Inverse mapping
 
 // Forward declarations
 void draw(void);
-void threadPool_init(void);
+void threadPool_init(int threadCount);
 void threadPool_wait(void);
+int threadPool_waitUntil(long long deadline);
+void idleLoop(SearchThread *thread, SplitPoint *waitSp);
+void mctsWorker(SearchThread *thread);
 void threadPool_destroy(void);
+void ponderStop(void);
+Pos aiWait(int stop);
 int getAdaptiveDepth(int moveNo);
-int minimax(int grid[N][M], int depth, int isMaximizing, int alpha, int beta);
+int negamax(SearchThread *thread, int ply, int depth, int side, int alpha,
+            int beta);
+int searchMove(SearchThread *thread, int ply, int depth, int side, int cell,
+               int index, int alpha, int beta);
+void rewardMove(SearchThread *thread, int ply, int depth, int side, int cell);
 
-void llog(const char *format, ...) {
-#ifdef LOG_ENABLED
-  va_list args;
-  va_start(args, format);
-  vfprintf(logfile, format, args);
-  fflush(logfile);
-  va_end(args);
+long long nowMs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+long long nowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Timestamps of trace records: the TSC on x86-64, a few cycles to read.
+// The writer pairs it with the monotonic clock now and then, which is how
+// the decoder converts ticks to time.
+static inline uint64_t traceClock(void) {
+#ifdef __x86_64__
+  return __builtin_ia32_rdtsc();
 #else
-  (void)format;
+  return (uint64_t)nowNs();
 #endif
 }
 
+void traceRelease(void *ring) {
+  atomic_store(&((TraceRing *)ring)->inUse, 0);
+}
+
+// Give this thread a ring: one left by an exited thread, else a new one.
+// NULL once TRACE_MAX_RINGS threads hold one.
+TraceRing *traceRingAcquire(void) {
+  TraceRing *ring = NULL;
+  int count = atomic_load(&tracer.ringCount);
+  for (int i = 0; i < count && i < TRACE_MAX_RINGS && !ring; i++) {
+    TraceRing *r = atomic_load(&tracer.rings[i]);
+    int free = 0;
+    if (r && atomic_compare_exchange_strong(&r->inUse, &free, 1))
+      ring = r;
+  }
+  if (!ring) {
+    int id = atomic_fetch_add(&tracer.ringCount, 1);
+    if (id >= TRACE_MAX_RINGS) {
+      atomic_fetch_sub(&tracer.ringCount, 1);
+      return NULL;
+    }
+    ring = aligned_alloc(CACHE_LINE, sizeof(TraceRing));
+    if (!ring) {
+      perror("alloc trace ring");
+      exit(1);
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->id = id;
+    ring->inUse = 1;
+    atomic_store(&tracer.rings[id], ring);
+  }
+  pthread_setspecific(tracer.key, ring);
+  traceRing = ring;
+  return ring;
+}
+
+static inline void traceEvent(int event, int32_t a, int32_t b, int32_t c,
+                              int32_t d, int32_t e) {
+  if (!atomic_load_explicit(&tracer.enabled, memory_order_relaxed))
+    return;
+  TraceRing *ring = traceRing ? traceRing : traceRingAcquire();
+  if (!ring)
+    return;
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >=
+      TRACE_RING_SIZE) {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    return;
+  }
+  TraceRecord *record = &ring->records[head % TRACE_RING_SIZE];
+  record->time = traceClock();
+  record->event = (uint16_t)event;
+  record->thread = (uint16_t)ring->id;
+  record->args[0] = a;
+  record->args[1] = b;
+  record->args[2] = c;
+  record->args[3] = d;
+  record->args[4] = e;
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// Append a clock record pairing traceClock() with the monotonic clock
+void traceWriteClock(void) {
+  long long ns = nowNs();
+  TraceRecord clock = {traceClock(), TRACE_CLOCK, UINT16_MAX,
+                       {(int32_t)(ns >> 32), (int32_t)ns, 0, 0, 0}};
+  fwrite(&clock, sizeof(clock), 1, tracer.file);
+}
+
+// Move every ring's new records to the file. Only one thread drains at a
+// time: the writer, or traceClose() after it has stopped.
+void traceDrain(void) {
+  int written = 0;
+  int count = atomic_load(&tracer.ringCount);
+  for (int i = 0; i < count && i < TRACE_MAX_RINGS; i++) {
+    TraceRing *ring = atomic_load(&tracer.rings[i]);
+    if (!ring)
+      continue;
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (head != tail && !written++)
+      traceWriteClock();
+    while (tail != head) {
+      uint64_t start = tail % TRACE_RING_SIZE;
+      uint64_t n = head - tail;
+      if (n > TRACE_RING_SIZE - start)
+        n = TRACE_RING_SIZE - start;
+      fwrite(&ring->records[start], sizeof(TraceRecord), n, tracer.file);
+      tail += n;
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+    unsigned dropped = atomic_exchange(&ring->dropped, 0);
+    if (dropped) {
+      TraceRecord record = {traceClock(), TRACE_DROPPED, (uint16_t)ring->id,
+                            {(int32_t)dropped, 0, 0, 0, 0}};
+      fwrite(&record, sizeof(record), 1, tracer.file);
+    }
+  }
+  if (written)
+    fflush(tracer.file);
+}
+
+// Writes the rings out every TRACE_FLUSH_MS, or sooner when asked
+void *traceWriter(void *arg) {
+  (void)arg;
+  pthread_mutex_lock(&tracer.lock);
+  while (!tracer.stop) {
+    if (!tracer.flush) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += TRACE_FLUSH_MS * 1000000L;
+      deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+      deadline.tv_nsec %= 1000000000L;
+      pthread_cond_timedwait(&tracer.wake, &tracer.lock, &deadline);
+    }
+    tracer.flush = 0;
+    pthread_mutex_unlock(&tracer.lock);
+    traceDrain();
+    pthread_mutex_lock(&tracer.lock);
+  }
+  pthread_mutex_unlock(&tracer.lock);
+  return NULL;
+}
+
+// Have the writer save what has been recorded so far, without waiting
+void traceFlush(void) {
+  if (!atomic_load_explicit(&tracer.enabled, memory_order_relaxed))
+    return;
+  pthread_mutex_lock(&tracer.lock);
+  tracer.flush = 1;
+  pthread_cond_signal(&tracer.wake);
+  pthread_mutex_unlock(&tracer.lock);
+}
+
+void traceClose(void) {
+  if (!tracer.file)
+    return;
+  atomic_store(&tracer.enabled, 0);
+  pthread_mutex_lock(&tracer.lock);
+  tracer.stop = 1;
+  pthread_cond_signal(&tracer.wake);
+  pthread_mutex_unlock(&tracer.lock);
+  pthread_join(tracer.writer, NULL);
+  traceDrain();
+  traceWriteClock();
+  fclose(tracer.file);
+  tracer.file = NULL;
+}
+
+int traceOpen(const char *path) {
+  tracer.file = fopen(path, "wb");
+  if (!tracer.file) {
+    perror("open trace file");
+    return 0;
+  }
+  TraceHeader header = {"ZGTRACE", TRACE_VERSION, N << 16 | M << 8 | WIN_LENGTH,
+                        sizeof(TraceRecord)};
+  fwrite(&header, sizeof(header), 1, tracer.file);
+  traceWriteClock();
+  pthread_key_create(&tracer.key, traceRelease);
+  pthread_mutex_init(&tracer.lock, NULL);
+  pthread_cond_init(&tracer.wake, NULL);
+  pthread_create(&tracer.writer, NULL, traceWriter, NULL);
+  atomic_store(&tracer.enabled, 1);
+  atexit(traceClose);
+  return 1;
+}
+
+long long nowUs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 void teardown(void) {
   printf("%s%s%s\n", SHOW_CURSOR, CLEAR_SCREEN, REPOS_CURSOR);
   fflush(stdout);
-  if (logfile)
-    fclose(logfile);
+  aiWait(1);
+  ponderStop();
   if (pool)
     threadPool_destroy();
   free(game);
+  game = NULL;
   tcsetattr(STDIN_FILENO, TCSAFLUSH, &origterm);
 }
 
+// Wake the UI loop from poll(); safe from any thread and signal handlers
+void wakeUp(void) {
+  char c = 0;
+  if (wakeupFds[1] >= 0 && write(wakeupFds[1], &c, 1) < 0) {
+    // Full pipe: the loop has a wakeup pending already
+  }
+}
+
+// The main loop quits (and teardown() runs) on its next turn
 void signal_hander(int signum) {
   (void)signum;
-  teardown();
-  exit(0);
+  quitRequested = 1;
+  wakeUp();
 }
 
 int isValidMove(int x, int y, int grid[N][M]) {
@@ -143,768 +796,4724 @@ Pos parseInput(void) {
   return p;
 }
 
-// Assign a score (negative -> good for user, positive -> good for AI)
-// The assignment is based on the given status of the grid
-// The heuristic is very simple, it assigns a score based on how many
-// in-a-row and interruptions there are for each users on the valid paths.
-int assignScoreToGrid(int grid[N][M]) {
-  int inarow = 0;
-  int player = 0;
-  int scores[2] = {0, 0};
+#ifndef BB_WORDS
+static inline Bitboard bbBit(int cell) { return (Bitboard)1 << cell; }
 
-  unsigned short int visited[2][N][M];
+static inline int bbTest(Bitboard b, int cell) { return (int)(b >> cell) & 1; }
 
-  memset(visited, 0, 2 * sizeof(unsigned short int) * N * M);
+static inline int bbAny(Bitboard b) { return b != 0; }
 
-  for (int i = 0; i < N; i++) {
-    for (int j = 0; j < M; j++) {
-      if (grid[i][j] == 0)
-        continue;
+// More than one bit set
+static inline int bbMany(Bitboard b) { return (b & (b - 1)) != 0; }
 
-      player = grid[i][j];
-
-      // Horiz
-      inarow = 1;
-      for (int h = j + 1; h < M; h++) {
-        if (grid[i][h] == player) {
-          visited[player - 1][i][h] = 1;
-          inarow++;
-          scores[player - 1] += MULTIPLIER_IN_A_ROW * inarow;
-          if (inarow == 4)
-            goto won;
-        } else if (grid[i][h] == 0) {
-          inarow = 0;
-          scores[player - 1] += 1;
-        } else {
-          inarow = 0;
-          break;
-        }
-      }
+static inline Bitboard bbAnd(Bitboard a, Bitboard b) { return a & b; }
 
-      // Vert
-      inarow = 1;
-      for (int v = i + 1; v < N; v++) {
-        if (grid[v][j] == player) {
-          visited[player - 1][v][j] = 1;
-          inarow++;
-          scores[player - 1] += MULTIPLIER_IN_A_ROW * inarow;
-          if (inarow == 4)
-            goto won;
-        } else if (grid[v][j] == 0) {
-          inarow = 0;
-          scores[player - 1] += 1;
-        } else {
-          inarow = 0;
-          break;
-        }
-      }
+static inline Bitboard bbOr(Bitboard a, Bitboard b) { return a | b; }
 
-      // Diag down-right
-      inarow = 1;
-      for (int h = j + 1, v = i + 1; v < N && h < M; v++, h++) {
-        if (grid[v][h] == player) {
-          visited[player - 1][v][h] = 1;
-          inarow++;
-          scores[player - 1] += MULTIPLIER_IN_A_ROW * inarow;
-          if (inarow == 4)
-            goto won;
-        } else if (grid[v][h] == 0) {
-          inarow = 0;
-          scores[player - 1] += 1;
-        } else {
-          inarow = 0;
-          break;
-        }
-      }
+static inline Bitboard bbAndNot(Bitboard a, Bitboard b) { return a & ~b; }
 
-      // Diag down-left
-      inarow = 1;
-      for (int h = j - 1, v = i + 1; v < N && h >= 0; v++, h--) {
-        if (grid[v][h] == player) {
-          visited[player - 1][v][h] = 1;
-          inarow++;
-          scores[player - 1] += MULTIPLIER_IN_A_ROW * inarow;
-          if (inarow == 4)
-            goto won;
-        } else if (grid[v][h] == 0) {
-          inarow = 0;
-          scores[player - 1] += 1;
-        } else {
-          inarow = 0;
-          break;
-        }
-      }
-    }
-  }
+static inline Bitboard bbShl(Bitboard b, int n) { return b << n; }
 
-  return scores[1] - scores[0];
+static inline Bitboard bbShr(Bitboard b, int n) { return b >> n; }
 
-won:
-  return player == 0 ? 0 : (player == 1 ? -1000 : 1000);
+// Index of the lowest set bit, b must be non-zero
+static inline int bbLsb(Bitboard b) {
+  uint64_t lo = (uint64_t)b;
+  return lo ? __builtin_ctzll(lo) : 64 + __builtin_ctzll((uint64_t)(b >> 64));
 }
 
-// Structure for move ordering in minimax
-typedef struct ScoredMove {
-  Pos pos;
-  int score;
-} ScoredMove;
+// Clear the lowest set bit of *b and return its index
+static inline int bbPopLsb(Bitboard *b) {
+  int cell = bbLsb(*b);
+  *b &= *b - 1;
+  return cell;
+}
 
-// Comparison function for sorting moves (best moves first for AI)
-int compareMoves(const void *a, const void *b) {
-  MoveTask *taskA = *(MoveTask **)a;
-  MoveTask *taskB = *(MoveTask **)b;
-  // Quick heuristic: use assignScoreToGrid as estimate
-  int scoreA = assignScoreToGrid(taskA->grid);
-  int scoreB = assignScoreToGrid(taskB->grid);
-  return scoreB - scoreA; // Sort descending (best first)
+static inline int bbCount(Bitboard b) {
+  return __builtin_popcountll((uint64_t)b) +
+         __builtin_popcountll((uint64_t)(b >> 64));
 }
 
-// Comparison for scored moves (maximizing player - descending)
-int compareScoredMovesMax(const void *a, const void *b) {
-  ScoredMove *moveA = (ScoredMove *)a;
-  ScoredMove *moveB = (ScoredMove *)b;
-  return moveB->score - moveA->score;
+// Index of the set bit with n set bits below it, n < bbCount(b)
+static inline int bbNth(Bitboard b, int n) {
+  uint64_t w = (uint64_t)b;
+  int base = 0;
+  if (n >= __builtin_popcountll(w)) {
+    n -= __builtin_popcountll(w);
+    w = (uint64_t)(b >> 64);
+    base = 64;
+  }
+  for (; n; n--)
+    w &= w - 1;
+  return base + __builtin_ctzll(w);
+}
+#else
+static inline Bitboard bbBit(int cell) {
+  Bitboard b = BB_NONE;
+  b.w[cell / 64] = 1ULL << (cell % 64);
+  return b;
 }
 
-// Comparison for scored moves (minimizing player - ascending)
-int compareScoredMovesMin(const void *a, const void *b) {
-  ScoredMove *moveA = (ScoredMove *)a;
-  ScoredMove *moveB = (ScoredMove *)b;
-  return moveA->score - moveB->score;
+static inline int bbTest(Bitboard b, int cell) {
+  return (int)(b.w[cell / 64] >> (cell % 64)) & 1;
 }
 
-// Thread worker function
-void *worker_thread(void *arg) {
-  (void)arg;
+static inline int bbAny(Bitboard b) {
+  uint64_t any = 0;
+#pragma GCC unroll 8
+  for (int i = 0; i < BB_WORDS; i++)
+    any |= b.w[i];
+  return any != 0;
+}
 
-  while (1) {
-    pthread_mutex_lock(&pool->mutex);
+static inline int bbMany(Bitboard b) {
+  int count = 0;
+  for (int i = 0; i < BB_WORDS; i++)
+    count += __builtin_popcountll(b.w[i]);
+  return count > 1;
+}
 
-    // Wait for work or shutdown signal
-    while (pool->next_task >= pool->task_count && !pool->shutdown) {
-      pthread_cond_wait(&pool->work_available, &pool->mutex);
-    }
+static inline Bitboard bbAnd(Bitboard a, Bitboard b) {
+#pragma GCC unroll 8
+  for (int i = 0; i < BB_WORDS; i++)
+    a.w[i] &= b.w[i];
+  return a;
+}
 
-    if (pool->shutdown) {
-      pthread_mutex_unlock(&pool->mutex);
-      break;
-    }
+static inline Bitboard bbOr(Bitboard a, Bitboard b) {
+#pragma GCC unroll 8
+  for (int i = 0; i < BB_WORDS; i++)
+    a.w[i] |= b.w[i];
+  return a;
+}
 
-    // Get next task
-    int task_idx = pool->next_task++;
-    pool->active_threads++;
-    pthread_mutex_unlock(&pool->mutex);
+static inline Bitboard bbAndNot(Bitboard a, Bitboard b) {
+#pragma GCC unroll 8
+  for (int i = 0; i < BB_WORDS; i++)
+    a.w[i] &= ~b.w[i];
+  return a;
+}
 
-    // Process task (outside of lock)
-    MoveTask *task = pool->tasks[task_idx];
-    int adaptiveDepth = getAdaptiveDepth(game->moveNo);
-    task->score = minimax(task->grid, adaptiveDepth, 0, -10000, 10000);
-    task->completed = 1;
+// Towards higher cells; bits pushed past the last word are lost
+static inline Bitboard bbShl(Bitboard b, int n) {
+  Bitboard r;
+  int words = n / 64, bits = n % 64;
+#pragma GCC unroll 8
+  for (int i = BB_WORDS - 1; i >= 0; i--) {
+    uint64_t hi = i >= words ? b.w[i - words] << bits : 0;
+    uint64_t lo = bits && i > words ? b.w[i - words - 1] >> (64 - bits) : 0;
+    r.w[i] = hi | lo;
+  }
+  return r;
+}
 
-    // Mark thread as done with this task
-    pthread_mutex_lock(&pool->mutex);
-    pool->active_threads--;
-    pthread_cond_signal(&pool->work_done);
-    pthread_mutex_unlock(&pool->mutex);
+static inline Bitboard bbShr(Bitboard b, int n) {
+  Bitboard r;
+  int words = n / 64, bits = n % 64;
+#pragma GCC unroll 8
+  for (int i = 0; i < BB_WORDS; i++) {
+    uint64_t lo = i + words < BB_WORDS ? b.w[i + words] >> bits : 0;
+    uint64_t hi = bits && i + words + 1 < BB_WORDS
+                      ? b.w[i + words + 1] << (64 - bits)
+                      : 0;
+    r.w[i] = lo | hi;
   }
+  return r;
+}
 
-  return NULL;
+static inline int bbLsb(Bitboard b) {
+  int i = 0;
+  while (!b.w[i])
+    i++;
+  return 64 * i + __builtin_ctzll(b.w[i]);
 }
 
-// Initialize thread pool
-void threadPool_init(void) {
-  pool = malloc(sizeof(ThreadPool));
-  pool->task_count = 0;
-  pool->next_task = 0;
-  pool->active_threads = 0;
-  pool->shutdown = 0;
+static inline int bbPopLsb(Bitboard *b) {
+  int i = 0;
+  while (!b->w[i])
+    i++;
+  int cell = 64 * i + __builtin_ctzll(b->w[i]);
+  b->w[i] &= b->w[i] - 1;
+  return cell;
+}
 
-  pthread_mutex_init(&pool->mutex, NULL);
-  pthread_cond_init(&pool->work_available, NULL);
-  pthread_cond_init(&pool->work_done, NULL);
+static inline int bbCount(Bitboard b) {
+  int count = 0;
+#pragma GCC unroll 8
+  for (int i = 0; i < BB_WORDS; i++)
+    count += __builtin_popcountll(b.w[i]);
+  return count;
+}
 
-  // Create worker threads
-  for (int i = 0; i < NUM_THREADS; i++) {
-    pthread_create(&pool->threads[i], NULL, worker_thread, NULL);
-  }
+static inline int bbNth(Bitboard b, int n) {
+  int i = 0;
+  while (n >= __builtin_popcountll(b.w[i]))
+    n -= __builtin_popcountll(b.w[i++]);
+  uint64_t w = b.w[i];
+  for (; n; n--)
+    w &= w - 1;
+  return 64 * i + __builtin_ctzll(w);
+}
+#endif
+
+static inline Bitboard boardEmpty(const Board *board) {
+  return bbAndNot(boardMask, bbOr(board->stones[0], board->stones[1]));
 }
 
-// Wait for all tasks to complete
-void threadPool_wait(void) {
-  pthread_mutex_lock(&pool->mutex);
-  while (pool->next_task < pool->task_count || pool->active_threads > 0) {
-    pthread_cond_wait(&pool->work_done, &pool->mutex);
+// One line as assignScoreToGrid() scores it: line[k] is 0 for an empty
+// cell, 1 or 2 for a stone of side 0 or 1, and 3 past the end. Returns side
+// 1's score minus side 0's.
+int lineScoreScalar(const int16_t *line, int length) {
+  int scores[3] = {0, 0, 0};
+  for (int i = 0; i < length; i++) {
+    int p = line[i];
+    if (!p)
+      continue;
+    int inarow = 1;
+    for (int k = i + 1; k < length && (line[k] == p || !line[k]); k++) {
+      if (line[k] == p) {
+        inarow++;
+        scores[p] += MULTIPLIER_IN_A_ROW * inarow;
+      } else {
+        inarow = 0;
+        scores[p] += 1;
+      }
+    }
   }
-  pthread_mutex_unlock(&pool->mutex);
+  return scores[2] - scores[1];
 }
 
-// Shutdown thread pool
-void threadPool_destroy(void) {
-  pthread_mutex_lock(&pool->mutex);
-  pool->shutdown = 1;
-  pthread_cond_broadcast(&pool->work_available);
-  pthread_mutex_unlock(&pool->mutex);
+#ifdef HAVE_AVX2
+// Every cell of the line walks at once, one 16-bit lane each
+__attribute__((target("avx2"))) int lineScoreAvx2(const int16_t *line,
+                                                  int length) {
+  __m256i zero = _mm256_setzero_si256();
+  __m256i owner = _mm256_loadu_si256((const __m256i *)line);
+  __m256i alive = _mm256_andnot_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi16(owner, zero),
+                      _mm256_cmpeq_epi16(owner, _mm256_set1_epi16(3))),
+      _mm256_set1_epi16(-1));
+  __m256i inarow = _mm256_set1_epi16(1);
+  __m256i score = zero;
 
-  // Join all threads
-  for (int i = 0; i < NUM_THREADS; i++) {
-    pthread_join(pool->threads[i], NULL);
+  for (int k = 1; k < length; k++) {
+    __m256i cell = _mm256_loadu_si256((const __m256i *)(line + k));
+    __m256i own = _mm256_cmpeq_epi16(cell, owner);
+    __m256i empty = _mm256_cmpeq_epi16(cell, zero);
+    alive = _mm256_and_si256(alive, _mm256_or_si256(own, empty));
+    // Own stone: one more in a row; empty cell: the row starts again
+    inarow = _mm256_and_si256(_mm256_sub_epi16(inarow, own), own);
+    __m256i gain = _mm256_or_si256(
+        _mm256_and_si256(own, _mm256_slli_epi16(inarow, 1)),
+        _mm256_and_si256(empty, _mm256_set1_epi16(1)));
+    score = _mm256_add_epi16(score, _mm256_and_si256(alive, gain));
   }
 
-  pthread_mutex_destroy(&pool->mutex);
-  pthread_cond_destroy(&pool->work_available);
-  pthread_cond_destroy(&pool->work_done);
-  free(pool);
+  // Side 1's walks count for, side 0's against
+  __m256i sign = _mm256_sub_epi16(
+      _mm256_cmpeq_epi16(owner, _mm256_set1_epi16(1)),
+      _mm256_cmpeq_epi16(owner, _mm256_set1_epi16(2)));
+  __m256i sums = _mm256_madd_epi16(score, sign);
+  __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(sums),
+                              _mm256_extracti128_si256(sums, 1));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+  return _mm_cvtsi128_si32(sum);
+}
+#endif
+
+static inline int lineScore(const int16_t *line, int length) {
+#ifdef HAVE_AVX2
+  if (useAvx2)
+    return lineScoreAvx2(line, length);
+#endif
+  return lineScoreScalar(line, length);
 }
 
-// Minimax with alpha-beta pruning
-// player: 1 = human (minimizing), 2 = AI (maximizing)
-// Returns the score for the current board state
-int minimax(int grid[N][M], int depth, int isMaximizing, int alpha, int beta) {
-  // Check if game is won/lost
-  int score = assignScoreToGrid(grid);
+// Cells of a line of length from its base-3 code, padded for lineScore()
+static inline void decodeLine(uint32_t code, int length, int16_t *line) {
+  int k = 0;
+  for (; k < length; k++, code /= 3)
+    line[k] = (int16_t)(code % 3);
+  for (; k < LINE_BUF; k++)
+    line[k] = 3;
+}
 
-  // Terminal conditions
-  if (score == -1000 || score == 1000) {
-    // Game won - return score adjusted by depth to prefer faster wins
-    return score + (score > 0 ? -depth : depth);
-  }
+// Score of a line from its code: a table lookup unless the line is long
+static inline int scoreOfLine(uint32_t code, int length) {
+  if (length <= LINE_TABLE_MAX)
+    return lineTable[length][code];
+  int16_t line[LINE_BUF];
+  decodeLine(code, length, line);
+  return lineScore(line, length);
+}
 
-  if (depth == 0) {
-    // Max depth reached - return heuristic score
-    return score;
+static inline void toggleHash(Board *board, int cell, int side) {
+  for (int s = 0; s < SYMMETRIES; s++)
+    board->hash[s] ^= zobrist[side][cell][s];
+}
+
+// Add digit (side + 1, or its negation to take the stone back) at cell to
+// the four lines through it, and rescore them
+static inline void updateLines(Board *board, int cell, int digit) {
+  for (int d = 0; d < 4; d++) {
+    int l = lineOf[d][cell];
+    uint32_t code = board->lineCodes[d][l] + digit * pow3[linePos[d][cell]];
+    int score = scoreOfLine(code, lineLength[d][l]);
+    board->lineCodes[d][l] = code;
+    board->score += score - board->lineScores[d][l];
+    board->lineScores[d][l] = (int16_t)score;
   }
+}
 
-  // Check if board is full (draw)
-  int movesPossible = 0;
-  for (int i = 0; i < N; i++) {
-    for (int j = 0; j < M; j++) {
-      if (grid[i][j] == 0) {
-        movesPossible = 1;
-        break;
-      }
+// Place / remove a stone for side (0 = human, 1 = AI) in place
+static inline void makeMove(Board *board, int cell, int side) {
+  board->stones[side] = bbOr(board->stones[side], bbBit(cell));
+  toggleHash(board, cell, side);
+  updateLines(board, cell, side + 1);
+}
+
+static inline void unmakeMove(Board *board, int cell, int side) {
+  board->stones[side] = bbAndNot(board->stones[side], bbBit(cell));
+  toggleHash(board, cell, side);
+  updateLines(board, cell, -(side + 1));
+}
+
+// Stones only, for searches that never evaluate: board->score is stale
+// until the matching removeStone()
+static inline void placeStone(Board *board, int cell, int side) {
+  board->stones[side] = bbOr(board->stones[side], bbBit(cell));
+}
+
+static inline void removeStone(Board *board, int cell, int side) {
+  board->stones[side] = bbAndNot(board->stones[side], bbBit(cell));
+}
+
+// The smallest of the symmetric hashes, the same for every mirror image of
+// the position; *sym receives the symmetry that produced it
+static inline uint64_t canonicalKey(const Board *board, int *sym) {
+  uint64_t key = board->hash[0];
+  *sym = 0;
+  for (int s = 1; s < SYMMETRIES; s++) {
+    if (board->hash[s] < key) {
+      key = board->hash[s];
+      *sym = s;
     }
-    if (movesPossible)
-      break;
-  }
-  if (!movesPossible) {
-    return 0; // Draw
   }
+  return key;
+}
 
-  if (isMaximizing) {
-    // AI's turn (maximize score) - with move ordering
-    ScoredMove moves[MAX_MOVES];
-    int moveCount = 0;
+// Key used to address the TT. With symmetry enabled this is the canonical
+// key and moves are stored in that canonical orientation.
+static inline uint64_t positionKey(const Board *board, int *sym) {
+  if (opts.symmetry)
+    return canonicalKey(board, sym);
+  *sym = 0;
+  return board->hash[0];
+}
 
-    // Generate and score all moves
-    for (int i = 0; i < N; i++) {
-      for (int j = 0; j < M; j++) {
-        if (grid[i][j] == 0) {
-          int newGrid[N][M];
-          memcpy(newGrid, grid, N * M * sizeof(int));
-          newGrid[i][j] = 2;
-          moves[moveCount].pos.x = i;
-          moves[moveCount].pos.y = j;
-          moves[moveCount].score = assignScoreToGrid(newGrid);
-          moveCount++;
-        }
-      }
-    }
+// splitmix64, fixed seed so hashes are reproducible between runs
+uint64_t nextRandom(uint64_t *state) {
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
 
-    // Sort moves (best first)
-    qsort(moves, moveCount, sizeof(ScoredMove), compareScoredMovesMax);
+// Map (x, y) through symmetry s. Indices 4+ are only used on square boards.
+Pos symmetryApply(int s, int x, int y) {
+  Pos p;
+  switch (s) {
+  case 0: // Identity
+    p.x = x, p.y = y;
+    break;
+  case 1: // Half turn
+    p.x = N - 1 - x, p.y = M - 1 - y;
+    break;
+  case 2: // Mirror columns
+    p.x = x, p.y = M - 1 - y;
+    break;
+  case 3: // Mirror rows
+    p.x = N - 1 - x, p.y = y;
+    break;
+  case 4: // Transpose
+    p.x = y, p.y = x;
+    break;
+  case 5: // Anti-transpose
+    p.x = M - 1 - y, p.y = N - 1 - x;
+    break;
+  case 6: // Quarter turn
+    p.x = y, p.y = N - 1 - x;
+    break;
+  default: // Three quarter turn
+    p.x = M - 1 - y, p.y = x;
+    break;
+  }
+  return p;
+}
 
-    // Evaluate moves in order
-    int maxEval = -10000;
-    for (int m = 0; m < moveCount; m++) {
-      int newGrid[N][M];
-      memcpy(newGrid, grid, N * M * sizeof(int));
-      newGrid[moves[m].pos.x][moves[m].pos.y] = 2;
+void initBitboards(void) {
+  static const int lineSteps[4][2] = {{0, 1}, {1, 0}, {1, 1}, {1, -1}};
+  uint64_t seed = 0x5A3C0FFEEULL;
 
-      int eval = minimax(newGrid, depth - 1, 0, alpha, beta);
-      maxEval = eval > maxEval ? eval : maxEval;
-      alpha = alpha > eval ? alpha : eval;
+#ifdef HAVE_AVX2
+  useAvx2 = !opts.noSimd && __builtin_cpu_supports("avx2");
+#endif
 
-      // Beta cutoff
-      if (beta <= alpha)
-        break;
+  // Scores of every short line, built once
+  pow3[0] = 1;
+  for (int k = 1; k <= MAX_LINE; k++)
+    pow3[k] = 3 * pow3[k - 1];
+  for (int length = 1; length <= LINE_TABLE_MAX && length <= MAX_LINE;
+       length++) {
+    if (lineTable[length])
+      break;
+    lineTable[length] = malloc(pow3[length] * sizeof(int16_t));
+    for (uint32_t code = 0; code < pow3[length]; code++) {
+      int16_t line[LINE_BUF];
+      decodeLine(code, length, line);
+      lineTable[length][code] = (int16_t)lineScoreScalar(line, length);
     }
-    return maxEval;
-  } else {
-    // Player's turn (minimize score) - with move ordering
-    ScoredMove moves[MAX_MOVES];
-    int moveCount = 0;
+  }
 
-    // Generate and score all moves
+  // A line starts at every cell whose predecessor is off the board
+  for (int d = 0; d < 4; d++) {
+    int dx = lineSteps[d][0], dy = lineSteps[d][1];
+    lineCount[d] = 0;
     for (int i = 0; i < N; i++) {
       for (int j = 0; j < M; j++) {
-        if (grid[i][j] == 0) {
-          int newGrid[N][M];
-          memcpy(newGrid, grid, N * M * sizeof(int));
-          newGrid[i][j] = 1;
-          moves[moveCount].pos.x = i;
-          moves[moveCount].pos.y = j;
-          moves[moveCount].score = assignScoreToGrid(newGrid);
-          moveCount++;
+        if (i - dx >= 0 && i - dx < N && j - dy >= 0 && j - dy < M)
+          continue;
+        int l = lineCount[d]++;
+        int k = 0;
+        for (int x = i, y = j; x < N && y >= 0 && y < M; x += dx, y += dy) {
+          lineCells[d][l][k] = CELL(x, y);
+          lineOf[d][CELL(x, y)] = l;
+          linePos[d][CELL(x, y)] = k++;
         }
+        lineLength[d][l] = k;
       }
     }
+  }
 
-    // Sort moves (worst first for minimizing player)
-    qsort(moves, moveCount, sizeof(ScoredMove), compareScoredMovesMin);
-
-    // Evaluate moves in order
-    int minEval = 10000;
-    for (int m = 0; m < moveCount; m++) {
-      int newGrid[N][M];
-      memcpy(newGrid, grid, N * M * sizeof(int));
-      newGrid[moves[m].pos.x][moves[m].pos.y] = 1;
-
-      int eval = minimax(newGrid, depth - 1, 1, alpha, beta);
+  boardMask = BB_NONE;
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j < M; j++) {
+      boardMask = bbOr(boardMask, bbBit(CELL(i, j)));
+    }
+  }
 
-      // If player can win, stop exploring
-      if (eval == -1000 + depth - 1) {
-        return eval;
+  // Chebyshev balls: the square of side 2 * radius + 1 around each cell
+  memset(neighborhood, 0, sizeof(neighborhood));
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j < M; j++) {
+      for (int x = i - opts.radius; x <= i + opts.radius; x++) {
+        for (int y = j - opts.radius; y <= j + opts.radius; y++) {
+          if (x >= 0 && x < N && y >= 0 && y < M)
+            neighborhood[CELL(i, j)] =
+                bbOr(neighborhood[CELL(i, j)], bbBit(CELL(x, y)));
+        }
       }
+    }
+  }
 
-      minEval = eval < minEval ? eval : minEval;
-      beta = beta < eval ? beta : eval;
+  for (int s = 0; s < SYMMETRIES; s++) {
+    for (int c = 0; c < CELLS; c++) {
+      symCell[s][c] = c; // Sentinel cells map to themselves
+    }
+    for (int i = 0; i < N; i++) {
+      for (int j = 0; j < M; j++) {
+        Pos t = symmetryApply(s, i, j);
+        symCell[s][CELL(i, j)] = CELL(t.x, t.y);
+      }
+    }
+    for (int c = 0; c < CELLS; c++) {
+      symCellInv[s][symCell[s][c]] = c;
+    }
+  }
 
-      // Alpha cutoff
-      if (beta <= alpha)
-        break;
+  for (int side = 0; side < 2; side++) {
+    uint64_t keys[CELLS];
+    for (int c = 0; c < CELLS; c++) {
+      keys[c] = nextRandom(&seed);
+    }
+    for (int c = 0; c < CELLS; c++) {
+      for (int s = 0; s < SYMMETRIES; s++) {
+        zobrist[side][c][s] = keys[symCell[s][c]];
+      }
     }
-    return minEval;
   }
 }
 
-// Calculate adaptive search depth based on game state
+// Runs of WIN_LENGTH stones along direction s, marked at their first cell.
+// Runs are doubled at each step, so four in a row takes two shifts and five
+// takes three. Callers pass the DIR_* constants so that every shift has a
+// fixed distance once inlined.
+__attribute__((always_inline)) static inline Bitboard
+lineStarts(Bitboard stones, int s) {
+  Bitboard runs = stones; // Cells starting a run of length stones
+  int length = 1;
+  while (2 * length <= WIN_LENGTH) {
+    runs = bbAnd(runs, bbShr(runs, length * s));
+    length *= 2;
+  }
+  if (length < WIN_LENGTH)
+    runs = bbAnd(runs, bbShr(runs, (WIN_LENGTH - length) * s));
+  return runs;
+}
+
+#if defined(HAVE_AVX2) && !defined(BB_WORDS) &&                               \
+    (WIN_LENGTH - 1) * DIR_DR < 64
+// The same tests for all four directions at once: one direction per 64-bit
+// lane, the 128-bit board split into a low and a high vector
+#define HAVE_AVX2_LINES
+typedef struct LineLanes {
+  __m256i lo, hi;
+} LineLanes;
+
+__attribute__((target("avx2"))) static inline LineLanes
+lanesBroadcast(Bitboard b) {
+  LineLanes r = {_mm256_set1_epi64x((long long)(uint64_t)b),
+                 _mm256_set1_epi64x((long long)(uint64_t)(b >> 64))};
+  return r;
+}
+
+// Shift each lane by k cells along its own direction, k < 64 / DIR_DR
+__attribute__((target("avx2"))) static inline LineLanes lanesShr(LineLanes b,
+                                                                 int k) {
+  __m256i n = _mm256_setr_epi64x(k * DIR_H, k * DIR_V, k * DIR_DR, k * DIR_DL);
+  __m256i back = _mm256_sub_epi64(_mm256_set1_epi64x(64), n);
+  LineLanes r = {_mm256_or_si256(_mm256_srlv_epi64(b.lo, n),
+                                 _mm256_sllv_epi64(b.hi, back)),
+                 _mm256_srlv_epi64(b.hi, n)};
+  return r;
+}
+
+__attribute__((target("avx2"))) static inline LineLanes lanesShl(LineLanes b,
+                                                                 int k) {
+  __m256i n = _mm256_setr_epi64x(k * DIR_H, k * DIR_V, k * DIR_DR, k * DIR_DL);
+  __m256i back = _mm256_sub_epi64(_mm256_set1_epi64x(64), n);
+  LineLanes r = {_mm256_sllv_epi64(b.lo, n),
+                 _mm256_or_si256(_mm256_sllv_epi64(b.hi, n),
+                                 _mm256_srlv_epi64(b.lo, back))};
+  return r;
+}
+
+__attribute__((target("avx2"))) static inline LineLanes lanesAnd(LineLanes a,
+                                                                 LineLanes b) {
+  LineLanes r = {_mm256_and_si256(a.lo, b.lo), _mm256_and_si256(a.hi, b.hi)};
+  return r;
+}
+
+__attribute__((target("avx2"))) static inline LineLanes lanesOr(LineLanes a,
+                                                                LineLanes b) {
+  LineLanes r = {_mm256_or_si256(a.lo, b.lo), _mm256_or_si256(a.hi, b.hi)};
+  return r;
+}
+
+__attribute__((target("avx2"))) int hasLineAvx2(Bitboard stones) {
+  LineLanes runs = lanesBroadcast(stones);
+  int length = 1;
+  while (2 * length <= WIN_LENGTH) {
+    runs = lanesAnd(runs, lanesShr(runs, length));
+    length *= 2;
+  }
+  if (length < WIN_LENGTH)
+    runs = lanesAnd(runs, lanesShr(runs, WIN_LENGTH - length));
+  __m256i any = _mm256_or_si256(runs.lo, runs.hi);
+  return !_mm256_testz_si256(any, any);
+}
+
+__attribute__((target("avx2"))) Bitboard winningCellsAvx2(Bitboard stones,
+                                                          Bitboard empty) {
+  LineLanes b = lanesBroadcast(stones);
+  LineLanes ahead[WIN_LENGTH], behind[WIN_LENGTH];
+  ahead[1] = lanesShr(b, 1);
+  behind[1] = lanesShl(b, 1);
+  for (int k = 2; k < WIN_LENGTH; k++) {
+    ahead[k] = lanesAnd(ahead[k - 1], lanesShr(b, k));
+    behind[k] = lanesAnd(behind[k - 1], lanesShl(b, k));
+  }
+  LineLanes gaps = lanesOr(ahead[WIN_LENGTH - 1], behind[WIN_LENGTH - 1]);
+  for (int i = 1; i < WIN_LENGTH - 1; i++)
+    gaps = lanesOr(gaps, lanesAnd(behind[i], ahead[WIN_LENGTH - 1 - i]));
+
+  // Fold the four directions together
+  __m128i lo = _mm_or_si128(_mm256_castsi256_si128(gaps.lo),
+                            _mm256_extracti128_si256(gaps.lo, 1));
+  __m128i hi = _mm_or_si128(_mm256_castsi256_si128(gaps.hi),
+                            _mm256_extracti128_si256(gaps.hi, 1));
+  uint64_t cellsLo = (uint64_t)(_mm_extract_epi64(lo, 0) |
+                                _mm_extract_epi64(lo, 1));
+  uint64_t cellsHi = (uint64_t)(_mm_extract_epi64(hi, 0) |
+                                _mm_extract_epi64(hi, 1));
+  return ((Bitboard)cellsHi << 64 | cellsLo) & empty;
+}
+#endif
+
+// Returns 1 if the stones contain WIN_LENGTH in a row in any direction
+int hasLine(Bitboard stones) {
+#ifdef HAVE_AVX2_LINES
+  if (useAvx2)
+    return hasLineAvx2(stones);
+#endif
+  return bbAny(lineStarts(stones, DIR_H)) || bbAny(lineStarts(stones, DIR_V)) ||
+         bbAny(lineStarts(stones, DIR_DR)) || bbAny(lineStarts(stones, DIR_DL));
+}
+
+// Cells that are the only one missing from a WIN_LENGTH window of the
+// stones along direction s
+__attribute__((always_inline)) static inline Bitboard
+lineGaps(Bitboard stones, int s) {
+  // ahead[k]: cells with stones on all of the next k cells along the line;
+  // behind[k] the same looking back
+  Bitboard ahead[WIN_LENGTH], behind[WIN_LENGTH];
+  ahead[1] = bbShr(stones, s);
+  behind[1] = bbShl(stones, s);
+  for (int k = 2; k < WIN_LENGTH; k++) {
+    ahead[k] = bbAnd(ahead[k - 1], bbShr(stones, k * s));
+    behind[k] = bbAnd(behind[k - 1], bbShl(stones, k * s));
+  }
+  // The missing cell has i owned cells behind it in its window
+  Bitboard gaps = bbOr(ahead[WIN_LENGTH - 1], behind[WIN_LENGTH - 1]);
+  for (int i = 1; i < WIN_LENGTH - 1; i++)
+    gaps = bbOr(gaps, bbAnd(behind[i], ahead[WIN_LENGTH - 1 - i]));
+  return gaps;
+}
+
+// Empty cells that would complete a line for the stones
+Bitboard winningCells(Bitboard stones, Bitboard empty) {
+#ifdef HAVE_AVX2_LINES
+  if (useAvx2)
+    return winningCellsAvx2(stones, empty);
+#endif
+  Bitboard cells = bbOr(bbOr(lineGaps(stones, DIR_H), lineGaps(stones, DIR_V)),
+                        bbOr(lineGaps(stones, DIR_DR), lineGaps(stones, DIR_DL)));
+  return bbAnd(cells, empty);
+}
+
+// Moves are written column letter then row number, like the board labels
+// ("e5")
+void formatCell(int cell, char *buf, size_t size) {
+  snprintf(buf, size, "%c%d", 'a' + cell % CELL_STRIDE, cell / CELL_STRIDE + 1);
+}
+
+// Parse "e5" (or "5e", as the UI accepts) into a cell, or -1
+int parseCell(const char *s) {
+  int row;
+  char col;
+  if (sscanf(s, "%c%d", &col, &row) != 2 && sscanf(s, "%d%c", &row, &col) != 2)
+    return -1;
+  if (col >= 'A' && col <= 'Z')
+    col = col - 'A' + 'a';
+  if (col < 'a' || col >= 'a' + M || row < 1 || row > N)
+    return -1;
+  return CELL(row - 1, col - 'a');
+}
+
+// Cells within opts.radius of any stone; deeper in the search the set is
+// grown one move at a time instead
+Bitboard candidateCells(const Board *board) {
+  Bitboard cells = BB_NONE;
+  for (Bitboard stones = bbOr(board->stones[0], board->stones[1]);
+       bbAny(stones);)
+    cells = bbOr(cells, neighborhood[bbPopLsb(&stones)]);
+  return cells;
+}
+
+// Moves worth searching: empty candidate cells, or every empty cell when
+// there are none (an empty board)
+static inline Bitboard candidateMoves(Bitboard candidates, Bitboard empty) {
+  Bitboard moves = bbAnd(candidates, empty);
+  return bbAny(moves) ? moves : empty;
+}
+
+void boardFromGrid(int grid[N][M], Board *board) {
+  memset(board, 0, sizeof(Board));
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j < M; j++) {
+      if (grid[i][j] != 0)
+        makeMove(board, CELL(i, j), grid[i][j] - 1);
+    }
+  }
+}
+
+// Allocate (or resize) the shared transposition table to roughly hashMb MB,
+// rounded down to a power of two number of buckets
+void tt_init(int hashMb) {
+  uint64_t bytes = (uint64_t)hashMb << 20;
+  uint64_t count = 1;
+  while (count * 2 * sizeof(TTBucket) <= bytes)
+    count *= 2;
+
+  free(tt.buckets);
+  tt.buckets = aligned_alloc(64, count * sizeof(TTBucket));
+  if (!tt.buckets) {
+    perror("alloc transposition table");
+    exit(1);
+  }
+  memset(tt.buckets, 0, count * sizeof(TTBucket));
+  tt.mask = count - 1;
+  tt.generation = 0;
+}
+
+// Data word layout: score (16) | depth (8) | move (8) | bound (8) | gen (8)
+static inline uint64_t tt_pack(int score, int depth, int bound, int move) {
+  return (uint64_t)(uint16_t)(score + 32768) | (uint64_t)(depth & 0xFF) << 16 |
+         (uint64_t)(move & 0xFF) << 24 | (uint64_t)bound << 32 |
+         (uint64_t)tt.generation << 40;
+}
+
+// Win scores are stored relative to the node rather than the root, so that
+// an entry stays correct when the position is reached at another ply
+static inline int scoreToTT(int score, int ply) {
+  if (score >= WIN_SCORE - MAX_PLY)
+    return score + ply;
+  if (score <= -WIN_SCORE + MAX_PLY)
+    return score - ply;
+  return score;
+}
+
+static inline int scoreFromTT(int score, int ply) {
+  if (score >= WIN_SCORE - MAX_PLY)
+    return score - ply;
+  if (score <= -WIN_SCORE + MAX_PLY)
+    return score + ply;
+  return score;
+}
+
+int tt_probe(uint64_t key, TTData *out) {
+  TTBucket *bucket = &tt.buckets[key & tt.mask];
+  for (int i = 0; i < TT_BUCKET_SIZE; i++) {
+    TTEntry *e = &bucket->entries[i];
+    uint64_t data = atomic_load_explicit(&e->data, memory_order_relaxed);
+    uint64_t check = atomic_load_explicit(&e->key, memory_order_relaxed);
+    if ((check ^ data) == key && data != 0) {
+      out->score = (int)(data & 0xFFFF) - 32768;
+      out->depth = (int)(data >> 16) & 0xFF;
+      out->move = (int)(data >> 24) & 0xFF;
+      out->bound = (int)(data >> 32) & 0xFF;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Replaces the entry for the same key, else the shallowest entry, counting
+// entries left over from earlier moves as shallower than anything current.
+void tt_store(uint64_t key, int depth, int bound, int score, int move) {
+  TTBucket *bucket = &tt.buckets[key & tt.mask];
+  TTEntry *victim = NULL;
+  int victimValue = 1 << 30;
+
+  for (int i = 0; i < TT_BUCKET_SIZE; i++) {
+    TTEntry *e = &bucket->entries[i];
+    uint64_t data = atomic_load_explicit(&e->data, memory_order_relaxed);
+    uint64_t check = atomic_load_explicit(&e->key, memory_order_relaxed);
+    if ((check ^ data) == key) {
+      // Keep a deeper result for this position unless it is stale
+      if ((int)((data >> 16) & 0xFF) > depth &&
+          (uint8_t)(data >> 40) == tt.generation && bound != BOUND_EXACT)
+        return;
+      victim = e;
+      break;
+    }
+    int value = (int)((data >> 16) & 0xFF);
+    if ((uint8_t)(data >> 40) != tt.generation)
+      value -= 256;
+    if (value < victimValue) {
+      victimValue = value;
+      victim = e;
+    }
+  }
+
+  uint64_t data = tt_pack(score, depth, bound, move);
+  atomic_store_explicit(&victim->data, data, memory_order_relaxed);
+  atomic_store_explicit(&victim->key, key ^ data, memory_order_relaxed);
+}
+
+// Assign a score (negative -> good for user, positive -> good for AI)
+// The assignment is based on the given status of the grid
+// The heuristic is very simple, it assigns a score based on how many
+// in-a-row and interruptions there are for each users on the valid paths.
+int assignScoreToGrid(const Board *board) {
+  int scores[2] = {0, 0};
+
+  if (hasLine(board->stones[0]))
+    return -1000;
+  if (hasLine(board->stones[1]))
+    return 1000;
+
+  for (int p = 0; p < 2; p++) {
+    Bitboard own = board->stones[p];
+    Bitboard opp = board->stones[1 - p];
+    Bitboard pending = own;
+
+    while (bbAny(pending)) {
+      int cell = bbPopLsb(&pending);
+
+      // Walk each direction until the edge or an opponent stone
+      for (int d = 0; d < 4; d++) {
+        int inarow = 1;
+        for (int c = cell + lineDirs[d]; c < CELLS && bbTest(boardMask, c);
+             c += lineDirs[d]) {
+          if (bbTest(own, c)) {
+            inarow++;
+            scores[p] += MULTIPLIER_IN_A_ROW * inarow;
+          } else if (bbTest(opp, c)) {
+            break;
+          } else {
+            inarow = 0;
+            scores[p] += 1;
+          }
+        }
+      }
+    }
+  }
+
+  return scores[1] - scores[0];
+}
+
+// Heuristic score after side plays cell, from side's point of view, as
+// assignScoreToGrid() gives it, without making the move: the child differs
+// from the board only on the four lines through cell. The move must not
+// complete a line.
+static inline int childScore(const Board *board, int side, int cell) {
+  int score = board->score;
+  for (int d = 0; d < 4; d++) {
+    int l = lineOf[d][cell];
+    uint32_t code =
+        board->lineCodes[d][l] + (side + 1) * pow3[linePos[d][cell]];
+    score += scoreOfLine(code, lineLength[d][l]) - board->lineScores[d][l];
+  }
+  return side ? score : -score;
+}
+
+// Comparison for scored moves (best first)
+int compareScoredMovesMax(const void *a, const void *b) {
+  ScoredMove *moveA = (ScoredMove *)a;
+  ScoredMove *moveB = (ScoredMove *)b;
+  return moveB->score - moveA->score;
+}
+
+// Work-stealing deque (Chase-Lev) of split point tickets. Only the owning
+// thread pushes and pops; any thread may steal.
+int deque_push(WorkDeque *q, SplitPoint *sp) {
+  long b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+  long t = atomic_load_explicit(&q->top, memory_order_acquire);
+  if (b - t >= DEQUE_SIZE)
+    return 0;
+  atomic_store_explicit(&q->items[b & (DEQUE_SIZE - 1)], sp,
+                        memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+  return 1;
+}
+
+SplitPoint *deque_pop(WorkDeque *q) {
+  long b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long t = atomic_load_explicit(&q->top, memory_order_relaxed);
+  SplitPoint *sp = NULL;
+
+  if (t <= b) {
+    sp = atomic_load_explicit(&q->items[b & (DEQUE_SIZE - 1)],
+                              memory_order_relaxed);
+    if (t == b) {
+      // Last ticket: race the thieves for it
+      if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+                                                   memory_order_seq_cst,
+                                                   memory_order_relaxed))
+        sp = NULL;
+      atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+    }
+  } else {
+    atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+  }
+  return sp;
+}
+
+SplitPoint *deque_steal(WorkDeque *q) {
+  long t = atomic_load_explicit(&q->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  long b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+  if (t >= b)
+    return NULL;
+
+  SplitPoint *sp = atomic_load_explicit(&q->items[t & (DEQUE_SIZE - 1)],
+                                        memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(
+          &q->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+    return NULL; // Lost the race, let the caller try elsewhere
+  return sp;
+}
+
+// Oldest ticket in q without taking it. Only a hint: it may be gone by the
+// time it is stolen.
+SplitPoint *deque_peek(WorkDeque *q) {
+  long t = atomic_load_explicit(&q->top, memory_order_acquire);
+  long b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+  if (t >= b)
+    return NULL;
+  return atomic_load_explicit(&q->items[t & (DEQUE_SIZE - 1)],
+                              memory_order_relaxed);
+}
+
+// True if sp is ancestor or one of its descendants. The walk is bounded since
+// a stale ticket's chain may be rewritten under us.
+int isDescendant(SplitPoint *sp, const SplitPoint *ancestor) {
+  for (int i = 0; sp && i < MAX_PLY; i++) {
+    if (sp == ancestor)
+      return 1;
+    sp = atomic_load_explicit(&sp->parent, memory_order_relaxed);
+  }
+  return 0;
+}
+
+// A thread must stop when the search is stopped or when any split point it
+// is working under has been cut off by another thread
+static inline int searchAborted(const SearchThread *thread) {
+  if (atomic_load_explicit(&pool->stop, memory_order_relaxed))
+    return 1;
+  for (SplitPoint *sp = thread->activeSplit; sp;
+       sp = atomic_load_explicit(&sp->parent, memory_order_relaxed)) {
+    if (atomic_load_explicit(&sp->cutoff, memory_order_relaxed))
+      return 1;
+  }
+  return 0;
+}
+
+void wakeIdleWorkers(void) {
+  atomic_fetch_add(&pool->workEpoch, 1);
+  if (atomic_load(&pool->sleepers) > 0) {
+    pthread_mutex_lock(&pool->idle_mutex);
+    pthread_cond_broadcast(&pool->idle_cond);
+    pthread_mutex_unlock(&pool->idle_mutex);
+  }
+}
+
+// Sleep until new tickets are pushed (the epoch moves), the search ends, or
+// a short timeout passes
+void sleepUntilWork(unsigned epoch) {
+  pthread_mutex_lock(&pool->idle_mutex);
+  atomic_fetch_add(&pool->sleepers, 1);
+  if (atomic_load(&pool->workEpoch) == epoch &&
+      atomic_load(&pool->searching)) {
+    long long deadline = nowMs() + 2;
+    struct timespec ts = {deadline / 1000, (deadline % 1000) * 1000000};
+    pthread_cond_timedwait(&pool->idle_cond, &pool->idle_mutex, &ts);
+  }
+  atomic_fetch_sub(&pool->sleepers, 1);
+  pthread_mutex_unlock(&pool->idle_mutex);
+}
+
+// Search moves of sp until none are left or a cutoff happens. Used by the
+// owner and by helpers alike; thread->board must hold sp's position.
+void searchSplitPoint(SearchThread *thread, SplitPoint *sp) {
+  while (1) {
+    pthread_mutex_lock(&sp->lock);
+    if (atomic_load_explicit(&sp->cutoff, memory_order_relaxed) ||
+        sp->nextMove >= sp->moveCount) {
+      pthread_mutex_unlock(&sp->lock);
+      break;
+    }
+    int index = sp->nextMove++;
+    int alpha = sp->alpha;
+    int beta = sp->beta;
+    pthread_mutex_unlock(&sp->lock);
+
+    int cell = sp->moves[index].cell;
+    int score = searchMove(thread, sp->ply, sp->depth, sp->side, cell, index,
+                           alpha, beta);
+    if (searchAborted(thread))
+      break;
+
+    pthread_mutex_lock(&sp->lock);
+    sp->moves[index].score = score;
+    if (score > sp->best) {
+      sp->best = score;
+      sp->bestCell = cell;
+    }
+    if (score > sp->alpha)
+      sp->alpha = score;
+    int cutoff = sp->alpha >= sp->beta;
+    if (cutoff)
+      atomic_store(&sp->cutoff, 1);
+    pthread_mutex_unlock(&sp->lock);
+
+    if (cutoff) {
+      STAT_INC(thread, cutoffs);
+      rewardMove(thread, sp->ply, sp->depth, sp->side, cell);
+      break;
+    }
+  }
+}
+
+// Join sp as a helper, if there is still something to do there
+void helpSplitPoint(SearchThread *thread, SplitPoint *sp) {
+  pthread_mutex_lock(&sp->lock);
+  int useful = !atomic_load(&sp->cutoff) && sp->nextMove < sp->moveCount;
+  pthread_mutex_unlock(&sp->lock);
+
+  if (useful) {
+    SplitPoint *saved = thread->activeSplit;
+    thread->board = sp->board;
+    thread->stack[sp->ply].candidates = sp->candidates;
+    thread->activeSplit = sp;
+    TRACE(TRACE_HELP_BEGIN, sp->ply, sp->depth);
+    searchSplitPoint(thread, sp);
+    TRACE(TRACE_HELP_END);
+    thread->activeSplit = saved;
+  }
+
+  // Last access to sp: the owner may return as soon as refs drops to 0
+  atomic_fetch_sub_explicit(&sp->refs, 1, memory_order_release);
+}
+
+// Steal a ticket from another worker. A master waiting on waitSp only takes
+// work below it, so that it never blocks an unrelated part of the tree.
+SplitPoint *stealTicket(SearchThread *thread, SplitPoint *waitSp) {
+  int count = pool->threadCount;
+  int start = (int)(nextRandom(&thread->rng) % count);
+
+  for (int i = 0; i < count; i++) {
+    SearchThread *victim = &pool->workers[(start + i) % count];
+    if (victim == thread)
+      continue;
+    if (waitSp) {
+      SplitPoint *hint = deque_peek(&victim->deque);
+      if (!hint || !isDescendant(hint, waitSp))
+        continue;
+    }
+    SplitPoint *sp = deque_steal(&victim->deque);
+    if (!sp)
+      continue;
+    if (waitSp && !isDescendant(sp, waitSp)) {
+      atomic_fetch_sub_explicit(&sp->refs, 1, memory_order_release);
+      continue;
+    }
+    return sp;
+  }
+  return NULL;
+}
+
+// Look for tickets to help with. Idle workers (waitSp == NULL) keep going
+// until the search ends; a master keeps going until every helper has left
+// its split point waitSp.
+void idleLoop(SearchThread *thread, SplitPoint *waitSp) {
+  int fails = 0;
+
+  atomic_fetch_add(&pool->idle, 1);
+  while (waitSp ? atomic_load_explicit(&waitSp->refs, memory_order_acquire) > 0
+                : atomic_load(&pool->searching)) {
+    unsigned epoch = atomic_load(&pool->workEpoch);
+    SplitPoint *sp = stealTicket(thread, waitSp);
+    if (sp) {
+      atomic_fetch_sub(&pool->idle, 1);
+      helpSplitPoint(thread, sp);
+      atomic_fetch_add(&pool->idle, 1);
+      fails = 0;
+    } else if (waitSp || ++fails < IDLE_SPINS) {
+      sched_yield();
+    } else {
+      TRACE(TRACE_SLEEP_BEGIN);
+      sleepUntilWork(epoch);
+      TRACE(TRACE_SLEEP_END);
+      fails = 0;
+    }
+  }
+  atomic_fetch_sub(&pool->idle, 1);
+}
+
+// Share the remaining moves of the current node (already filled into sp by
+// the caller) with idle workers and search them together. On return sp
+// holds the node's result.
+void split(SearchThread *thread, SplitPoint *sp) {
+  atomic_store_explicit(&sp->parent, thread->activeSplit,
+                        memory_order_relaxed);
+  sp->board = thread->board;
+  sp->candidates = thread->stack[sp->ply].candidates;
+  atomic_store(&sp->cutoff, 0);
+  atomic_store(&sp->refs, 0);
+
+  // One ticket per idle worker, never more than there are moves to share
+  int tickets = atomic_load(&pool->idle);
+  if (tickets > sp->moveCount - sp->nextMove - 1)
+    tickets = sp->moveCount - sp->nextMove - 1;
+  int pushed = 0;
+  for (; pushed < tickets; pushed++) {
+    atomic_fetch_add(&sp->refs, 1);
+    if (!deque_push(&thread->deque, sp)) {
+      atomic_fetch_sub(&sp->refs, 1);
+      break;
+    }
+  }
+  if (pushed > 0)
+    wakeIdleWorkers();
+
+  thread->activeSplit = sp;
+  searchSplitPoint(thread, sp);
+
+  // Take back the tickets nobody claimed. Ours are the newest, so they sit at
+  // the bottom of the deque above any older split point's.
+  for (int i = 0; i < pushed; i++) {
+    SplitPoint *ticket = deque_pop(&thread->deque);
+    if (!ticket)
+      break;
+    if (ticket != sp) {
+      deque_push(&thread->deque, ticket);
+      break;
+    }
+    atomic_fetch_sub(&sp->refs, 1);
+  }
+
+  // Help below sp until every helper has left, then restore our board
+  if (atomic_load_explicit(&sp->refs, memory_order_acquire) > 0) {
+    idleLoop(thread, sp);
+    thread->board = sp->board;
+  }
+  thread->activeSplit = sp->parent;
+}
+
+// Root node of one iteration, run by worker 0: the eldest move on its own,
+// then the rest through a split point like any other node. Every root move
+// gets its score written back into pool->rootMoves (an upper bound for
+// moves that failed low), and the best one into pool->bestCell/bestScore.
+void rootSearch(SearchThread *thread) {
+  ScoredMove *moves = pool->rootMoves;
+  int moveCount = pool->rootMoveCount;
+  int side = pool->side;
+  int depth = pool->depth + 1;
+
+  thread->board = pool->root;
+  thread->stack[0].candidates = candidateCells(&thread->board);
+  thread->activeSplit = NULL;
+  thread->stack[1].killers[0] = NO_MOVE;
+  thread->stack[1].killers[1] = NO_MOVE;
+  STAT_INC(thread, plyNodes[0]);
+  for (int i = 0; i < moveCount; i++) {
+    moves[i].score = -INF_SCORE;
+  }
+
+  moves[0].score = searchMove(thread, 0, depth, side, moves[0].cell, 0,
+                              pool->alpha, pool->beta);
+  pool->bestCell = moves[0].cell;
+  pool->bestScore = moves[0].score;
+  if (searchAborted(thread) || moveCount == 1 || moves[0].score >= pool->beta)
+    return;
+
+  SplitPoint *sp = &thread->splitPoints[0];
+  sp->ply = 0;
+  sp->depth = depth;
+  sp->side = side;
+  sp->moves = moves;
+  sp->moveCount = moveCount;
+  sp->nextMove = 1;
+  sp->alpha = pool->alpha > moves[0].score ? pool->alpha : moves[0].score;
+  sp->beta = pool->beta;
+  sp->best = moves[0].score;
+  sp->bestCell = moves[0].cell;
+  split(thread, sp);
+  pool->bestCell = sp->bestCell;
+  pool->bestScore = sp->best;
+}
+
+// Thread worker function
+void *worker_thread(void *arg) {
+  SearchThread *thread = arg;
+  TRACE(TRACE_WORKER, thread->id);
+
+  while (1) {
+    pthread_mutex_lock(&pool->mutex);
+
+    // Wait for work or shutdown signal: worker 0 for a root search to run,
+    // the others for any running search to help with
+    while (!pool->shutdown &&
+           !(thread->id == 0 ? pool->jobPending
+                             : atomic_load(&pool->searching))) {
+      pthread_cond_wait(&pool->work_available, &pool->mutex);
+    }
+
+    if (pool->shutdown) {
+      pthread_mutex_unlock(&pool->mutex);
+      break;
+    }
+
+    if (thread->id == 0) {
+      pool->jobPending = 0;
+      atomic_store(&pool->searching, 1);
+      pthread_cond_broadcast(&pool->work_available);
+      pthread_mutex_unlock(&pool->mutex);
+
+      if (pool->mcts) {
+        TRACE(TRACE_MCTS_BEGIN);
+        mctsWorker(thread);
+        TRACE(TRACE_MCTS_END);
+      } else {
+        TRACE(TRACE_ROOT_BEGIN, pool->depth);
+        rootSearch(thread);
+        TRACE(TRACE_ROOT_END);
+      }
+
+      pthread_mutex_lock(&pool->mutex);
+      atomic_store(&pool->searching, 0);
+      pthread_cond_broadcast(&pool->work_done);
+      pthread_mutex_unlock(&pool->mutex);
+      wakeIdleWorkers(); // Let sleeping helpers see the search is over
+    } else {
+      int mcts = pool->mcts;
+      pthread_mutex_unlock(&pool->mutex);
+      if (mcts) {
+        TRACE(TRACE_MCTS_BEGIN);
+        mctsWorker(thread);
+        TRACE(TRACE_MCTS_END);
+      } else {
+        idleLoop(thread, NULL);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+int onlineCpus(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+}
+
+// Number of workers to start: --threads, else one per online CPU
+int configuredThreads(void) {
+  int n = opts.threads > 0 ? opts.threads : onlineCpus();
+  return n < MAX_THREADS ? n : MAX_THREADS;
+}
+
+// Initialize thread pool
+void threadPool_init(int threadCount) {
+  pool = calloc(1, sizeof(ThreadPool));
+  pool->threadCount = threadCount;
+  pool->threads = calloc(threadCount, sizeof(pthread_t));
+  pool->workers = aligned_alloc(CACHE_LINE, threadCount * sizeof(SearchThread));
+  if (!pool->threads || !pool->workers) {
+    perror("alloc thread pool");
+    exit(1);
+  }
+  memset(pool->workers, 0, threadCount * sizeof(SearchThread));
+  pool->shutdown = 0;
+  pool->jobPending = 0;
+  atomic_init(&pool->searching, 0);
+  atomic_init(&pool->stop, 0);
+  atomic_init(&pool->idle, 0);
+  atomic_init(&pool->sleepers, 0);
+  atomic_init(&pool->workEpoch, 0);
+
+  // work_done and idle_cond are waited on against monotonic deadlines
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->work_available, NULL);
+  pthread_cond_init(&pool->work_done, &attr);
+  pthread_mutex_init(&pool->idle_mutex, NULL);
+  pthread_cond_init(&pool->idle_cond, &attr);
+  pthread_condattr_destroy(&attr);
+
+  for (int i = 0; i < threadCount; i++) {
+    SearchThread *thread = &pool->workers[i];
+    thread->id = i;
+    thread->rng = (uint64_t)i * 0x2545F4914F6CDD1DULL + 1;
+    for (int ply = 0; ply < MAX_PLY; ply++) {
+      pthread_mutex_init(&thread->splitPoints[ply].lock, NULL);
+    }
+  }
+
+  // Create worker threads, optionally pinned one per CPU
+  int cpus = onlineCpus();
+  for (int i = 0; i < threadCount; i++) {
+    pthread_create(&pool->threads[i], NULL, worker_thread, &pool->workers[i]);
+    if (opts.pin) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(i % cpus, &set);
+      pthread_setaffinity_np(pool->threads[i], sizeof(set), &set);
+    }
+  }
+}
+
+// Total nodes searched by all workers since the last search started; may be
+// called while the search runs
+uint64_t threadPool_nodes(void) {
+  uint64_t nodes = 0;
+  for (int i = 0; i < pool->threadCount; i++) {
+    nodes += __atomic_load_n(&pool->workers[i].nodes, __ATOMIC_RELAXED);
+  }
+  return nodes;
+}
+
+// Sum of every worker's statistics for the last search
+void threadPool_stats(SearchStats *out) {
+  memset(out, 0, sizeof(*out));
+  for (int i = 0; i < pool->threadCount; i++) {
+    // All fields are uint64_t counters
+    const uint64_t *in = (const uint64_t *)&pool->workers[i].stats;
+    uint64_t *sum = (uint64_t *)out;
+    for (size_t f = 0; f < sizeof(SearchStats) / sizeof(uint64_t); f++)
+      sum[f] += in[f];
+  }
+  out->nodes = threadPool_nodes();
+}
+
+// One line for the UI: how big the search was and how well it was ordered
+void formatStatsSummary(const SearchStats *stats, long long timeMs, char *buf,
+                        size_t size) {
+  uint64_t interior = 0, moves = 0;
+  for (int ply = 0; ply < MAX_PLY; ply++) {
+    interior += stats->plyNodes[ply];
+    moves += stats->plyMoves[ply];
+  }
+  snprintf(buf, size,
+           "%.2fM nodes, %.2fM nps, branching %.1f, cutoffs %.0f%% on first "
+           "move, TT hits %.0f%%",
+           stats->nodes / 1e6, stats->nodes / 1e3 / (timeMs > 0 ? timeMs : 1),
+           interior ? (double)moves / interior : 0.0,
+           stats->cutoffs ? 100.0 * stats->firstCutoffs / stats->cutoffs : 0.0,
+           stats->ttProbes ? 100.0 * stats->ttHits / stats->ttProbes : 0.0);
+}
+
+// Append the statistics of one search to f as a single JSON line
+void writeStatsJson(FILE *f, const SearchStats *stats,
+                    const SearchResult *result) {
+  char move[16] = "none";
+  if (result->cell != NO_MOVE)
+    formatCell(result->cell, move, sizeof(move));
+  fprintf(f,
+          "{\"bestmove\": \"%s\", \"score\": %d, \"depth\": %d, "
+          "\"timeMs\": %lld, \"nodes\": %llu, \"leaves\": %llu, "
+          "\"cutoffs\": %llu, \"firstMoveCutoffs\": %llu, "
+          "\"ttProbes\": %llu, \"ttHits\": %llu, \"ttCutoffs\": %llu, "
+          "\"branching\": [",
+          move, result->score, result->depth, result->timeMs,
+          (unsigned long long)stats->nodes, (unsigned long long)stats->leaves,
+          (unsigned long long)stats->cutoffs,
+          (unsigned long long)stats->firstCutoffs,
+          (unsigned long long)stats->ttProbes,
+          (unsigned long long)stats->ttHits,
+          (unsigned long long)stats->ttCutoffs);
+  for (int ply = 0; ply < MAX_PLY && stats->plyNodes[ply]; ply++) {
+    fprintf(f, "%s%.2f", ply ? ", " : "",
+            (double)stats->plyMoves[ply] / stats->plyNodes[ply]);
+  }
+  fprintf(f, "], \"rootMoveMs\": {");
+  int first = 1;
+  for (int cell = 0; cell < CELLS; cell++) {
+    if (!stats->rootUs[cell])
+      continue;
+    formatCell(cell, move, sizeof(move));
+    fprintf(f, "%s\"%s\": %.3f", first ? "" : ", ", move,
+            stats->rootUs[cell] / 1000.0);
+    first = 0;
+  }
+  fprintf(f, "}}\n");
+  fflush(f);
+}
+
+// Wait for the running root search to complete
+void threadPool_wait(void) {
+  pthread_mutex_lock(&pool->mutex);
+  while (pool->jobPending || atomic_load(&pool->searching)) {
+    pthread_cond_wait(&pool->work_done, &pool->mutex);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+// Wait for the running root search to complete or the deadline (monotonic
+// ms) to pass, whichever comes first. Returns 1 if the search completed.
+int threadPool_waitUntil(long long deadline) {
+  struct timespec ts = {deadline / 1000, (deadline % 1000) * 1000000};
+  int done;
+
+  pthread_mutex_lock(&pool->mutex);
+  while (pool->jobPending || atomic_load(&pool->searching)) {
+    if (pthread_cond_timedwait(&pool->work_done, &pool->mutex, &ts) != 0)
+      break;
+  }
+  done = !pool->jobPending && !atomic_load(&pool->searching);
+  pthread_mutex_unlock(&pool->mutex);
+  return done;
+}
+
+// Shutdown thread pool
+void threadPool_destroy(void) {
+  pthread_mutex_lock(&pool->mutex);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->work_available);
+  pthread_mutex_unlock(&pool->mutex);
+
+  // Join all threads
+  for (int i = 0; i < pool->threadCount; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  for (int i = 0; i < pool->threadCount; i++) {
+    for (int ply = 0; ply < MAX_PLY; ply++) {
+      pthread_mutex_destroy(&pool->workers[i].splitPoints[ply].lock);
+    }
+  }
+  pthread_mutex_destroy(&pool->mutex);
+  pthread_cond_destroy(&pool->work_available);
+  pthread_cond_destroy(&pool->work_done);
+  pthread_mutex_destroy(&pool->idle_mutex);
+  pthread_cond_destroy(&pool->idle_cond);
+  free(pool->workers);
+  free(pool->threads);
+  free(pool);
+  pool = NULL;
+}
+
+// Depth reduction for the index-th move of a node searched to depth. The
+// first moves, shallow nodes and moves that make or answer a threat of an
+// immediate win are searched at full depth.
+static inline int lmrReduction(const Board *board, int depth, int side,
+                               int cell, int index) {
+  if (depth < LMR_MIN_DEPTH || index < LMR_MIN_MOVES)
+    return 0;
+  Bitboard empty = boardEmpty(board);
+  if (bbAny(winningCells(board->stones[side], empty)) ||
+      bbAny(winningCells(board->stones[1 - side], bbOr(empty, bbBit(cell)))))
+    return 0;
+  return depth >= 6 && index >= 4 * LMR_MIN_MOVES ? 2 : 1;
+}
+
+void initMovePicker(MovePicker *mp, SearchThread *thread, int ply, int side,
+                    int ttMove) {
+  const Board *board = &thread->board;
+  Bitboard empty = boardEmpty(board);
+  mp->stage = STAGE_TT;
+  mp->side = side;
+  mp->ttMove = ttMove;
+  mp->killers = thread->stack[ply].killers;
+  mp->todo = candidateMoves(thread->stack[ply].candidates, empty);
+  mp->blocks = winningCells(board->stones[1 - side], empty);
+  mp->moves = thread->stack[ply].moves;
+  mp->count = 0;
+  mp->end = 0;
+}
+
+static inline int pickerTake(MovePicker *mp, int cell, int score) {
+  mp->todo = bbAndNot(mp->todo, bbBit(cell));
+  mp->moves[mp->count].cell = cell;
+  mp->moves[mp->count].score = score;
+  mp->count++;
+  return cell;
+}
+
+// Next move to search, or -1 when there are none left
+int nextMove(MovePicker *mp, const int history[CELLS]) {
+  switch (mp->stage) {
+  case STAGE_TT:
+    mp->stage++;
+    if (mp->ttMove != NO_MOVE && bbTest(mp->todo, mp->ttMove))
+      return pickerTake(mp, mp->ttMove, INF_SCORE);
+    // fall through
+  case STAGE_BLOCKS:
+    while (bbAny(mp->blocks)) {
+      int cell = bbPopLsb(&mp->blocks);
+      if (bbTest(mp->todo, cell))
+        return pickerTake(mp, cell, INF_SCORE - 1);
+    }
+    mp->stage++;
+    // fall through
+  case STAGE_KILLERS:
+    for (int k = 0; k < 2; k++) {
+      int cell = mp->killers[k];
+      if (cell != NO_MOVE && bbTest(mp->todo, cell))
+        return pickerTake(mp, cell, INF_SCORE - 2 - k);
+    }
+    mp->stage++;
+    // fall through
+  case STAGE_GENERATE:
+    mp->end = mp->count;
+    for (Bitboard todo = mp->todo; bbAny(todo);) {
+      int cell = bbPopLsb(&todo);
+      mp->moves[mp->end].cell = cell;
+      mp->moves[mp->end].score = history[cell];
+      mp->end++;
+    }
+    mp->stage++;
+    // fall through
+  case STAGE_QUIET:
+    if (mp->count < mp->end) {
+      // Selection step: a node that cuts off early never sorts the rest
+      int best = mp->count;
+      for (int i = mp->count + 1; i < mp->end; i++) {
+        if (mp->moves[i].score > mp->moves[best].score)
+          best = i;
+      }
+      ScoredMove move = mp->moves[best];
+      mp->moves[best] = mp->moves[mp->count];
+      mp->moves[mp->count++] = move;
+      return move.cell;
+    }
+    mp->stage = STAGE_DONE;
+    // fall through
+  default:
+    return -1;
+  }
+}
+
+// Append every move not returned yet after the returned ones, best first,
+// so the node can hand them to a split point. Returns the total count.
+int finishMovePicker(MovePicker *mp, const int history[CELLS]) {
+  int start = mp->count;
+  if (mp->stage < STAGE_QUIET) {
+    for (Bitboard todo = mp->todo; bbAny(todo);) {
+      int cell = bbPopLsb(&todo);
+      int score = history[cell];
+      if (cell == mp->ttMove)
+        score = INF_SCORE;
+      else if (bbTest(mp->blocks, cell))
+        score = INF_SCORE - 1;
+      else if (cell == mp->killers[0] || cell == mp->killers[1])
+        score = INF_SCORE - 2;
+      pickerTake(mp, cell, score);
+    }
+  } else {
+    mp->count = mp->end;
+  }
+  qsort(mp->moves + start, mp->count - start, sizeof(ScoredMove),
+        compareScoredMovesMax);
+  mp->todo = BB_NONE;
+  mp->stage = STAGE_DONE;
+  return mp->count;
+}
+
+// A move caused a beta cutoff: make it a killer of its ply and raise its
+// history score, so siblings and similar positions try it early
+void rewardMove(SearchThread *thread, int ply, int depth, int side, int cell) {
+  int *killers = thread->stack[ply].killers;
+  if (killers[0] != cell) {
+    killers[1] = killers[0];
+    killers[0] = cell;
+  }
+
+  int *history = thread->history[side];
+  history[cell] += depth * depth;
+  if (history[cell] > HISTORY_MAX) {
+    for (int c = 0; c < CELLS; c++)
+      history[c] /= 2;
+  }
+}
+
+// Search the index-th move (cell) of the node at ply: principal variation
+// search. The eldest move gets the full window; the others a null window
+// around alpha, possibly at reduced depth, and are searched again at full
+// depth and then with the full window only if they beat alpha.
+// Returns the score from side's point of view.
+int searchMove(SearchThread *thread, int ply, int depth, int side, int cell,
+               int index, int alpha, int beta) {
+  Board *board = &thread->board;
+  int score;
+#ifndef NO_STATS
+  long long start = ply == 0 ? nowUs() : 0;
+#endif
+
+  STAT_INC(thread, plyMoves[ply]);
+  thread->stack[ply + 1].candidates =
+      bbOr(thread->stack[ply].candidates, neighborhood[cell]);
+  makeMove(board, cell, side);
+  if (index == 0) {
+    score = -negamax(thread, ply + 1, depth - 1, 1 - side, -beta, -alpha);
+  } else {
+    int reduction = lmrReduction(board, depth, side, cell, index);
+    score = -negamax(thread, ply + 1, depth - 1 - reduction, 1 - side,
+                     -alpha - 1, -alpha);
+    if (reduction && score > alpha)
+      score = -negamax(thread, ply + 1, depth - 1, 1 - side, -alpha - 1,
+                       -alpha);
+    if (score > alpha && score < beta)
+      score = -negamax(thread, ply + 1, depth - 1, 1 - side, -beta, -alpha);
+  }
+  unmakeMove(board, cell, side);
+#ifndef NO_STATS
+  if (ply == 0)
+    thread->stats.rootUs[cell] += nowUs() - start;
+#endif
+  return score;
+}
+
+// Score of a child of a frontier node, whose children are all leaves,
+// without visiting it: what the leaf evaluation gives, unless the move
+// leaves the opponent a cell that completes a line. It cannot complete one
+// itself, or negamax() would have stopped at the win in one.
+static inline int frontierScore(SearchThread *thread, int ply, int side,
+                                int cell, Bitboard threats) {
+  STAT_INC(thread, plyMoves[ply]);
+  thread->nodes++;
+  if (bbAny(bbAndNot(threats, bbBit(cell))))
+    return -WIN_SCORE + ply + 2;
+  STAT_INC(thread, leaves);
+  return childScore(&thread->board, side, cell);
+}
+
+// Negamax alpha-beta search of thread->board with side to move
+// (1 = AI, 0 = human); ply indexes the thread's search stack.
+// Returns the score from side's point of view; fails soft.
+int negamax(SearchThread *thread, int ply, int depth, int side, int alpha,
+            int beta) {
+  Board *board = &thread->board;
+
+  // Search aborted: the caller discards whatever comes back
+  if (searchAborted(thread))
+    return 0;
+  thread->nodes++;
+
+  // The previous move won: prefer the fastest win and the slowest loss
+  if (hasLine(board->stones[1 - side]))
+    return -WIN_SCORE + ply;
+
+  // Side to move completes a line next move
+  if (bbAny(winningCells(board->stones[side], boardEmpty(board))))
+    return WIN_SCORE - ply - 1;
+
+  if (depth <= 0 || ply >= MAX_PLY - 1) {
+    // Max depth reached - return heuristic score
+    STAT_INC(thread, leaves);
+    return side ? board->score : -board->score;
+  }
+
+  // Check if board is full (draw)
+  Bitboard empty = boardEmpty(board);
+  if (!bbAny(empty)) {
+    return 0; // Draw
+  }
+
+  // Transposition table: reuse earlier results for this position (or any of
+  // its symmetric twins) and try the stored best move first
+  int alphaOrig = alpha;
+  int sym;
+  uint64_t key = positionKey(board, &sym);
+  int ttMove = NO_MOVE;
+  TTData entry;
+  STAT_INC(thread, ttProbes);
+  if (tt_probe(key, &entry)) {
+    STAT_INC(thread, ttHits);
+    if (entry.move != NO_MOVE)
+      ttMove = symCellInv[sym][entry.move];
+    int ttScore = scoreFromTT(entry.score, ply);
+    if (entry.depth >= depth &&
+        (entry.bound == BOUND_EXACT ||
+         (entry.bound == BOUND_LOWER && ttScore >= beta) ||
+         (entry.bound == BOUND_UPPER && ttScore <= alpha))) {
+      STAT_INC(thread, ttCutoffs);
+      return ttScore;
+    }
+  }
+  STAT_INC(thread, plyNodes[ply]);
+
+  // Killers of the children's ply are from another part of the tree
+  if (ply + 1 < MAX_PLY) {
+    thread->stack[ply + 1].killers[0] = NO_MOVE;
+    thread->stack[ply + 1].killers[1] = NO_MOVE;
+  }
+
+  MovePicker mp;
+  initMovePicker(&mp, thread, ply, side, ttMove);
+  const int *history = thread->history[side];
+
+  // Frontier: the children are leaves, scored from this node's lines
+  int frontier = depth == 1 || ply + 1 >= MAX_PLY - 1;
+  Bitboard threats = BB_NONE;
+  if (frontier)
+    threats = winningCells(board->stones[1 - side], empty);
+
+  int bestScore = -INF_SCORE;
+  int bestCell = NO_MOVE;
+  int cell;
+  for (int m = 0; (cell = nextMove(&mp, history)) >= 0; m++) {
+    // Young brothers wait: once the eldest move has been searched, share
+    // the remaining ones with idle workers
+    if (m > 0 && depth >= SPLIT_MIN_DEPTH &&
+        atomic_load_explicit(&pool->idle, memory_order_relaxed) > 0) {
+      int moveCount = finishMovePicker(&mp, history);
+      if (moveCount - m > 1) {
+        SplitPoint *sp = &thread->splitPoints[ply];
+        sp->ply = ply;
+        sp->depth = depth;
+        sp->side = side;
+        sp->moves = mp.moves;
+        sp->moveCount = moveCount;
+        sp->nextMove = m;
+        sp->alpha = alpha;
+        sp->beta = beta;
+        sp->best = bestScore;
+        sp->bestCell = bestCell;
+        split(thread, sp);
+        if (searchAborted(thread))
+          return 0;
+
+        bestScore = sp->best;
+        bestCell = sp->bestCell;
+        break;
+      }
+    }
+
+    int score = frontier ? frontierScore(thread, ply, side, cell, threats)
+                         : searchMove(thread, ply, depth, side, cell, m, alpha,
+                                      beta);
+    if (searchAborted(thread))
+      return 0;
+
+    if (score > bestScore) {
+      bestScore = score;
+      bestCell = cell;
+    }
+    if (score > alpha)
+      alpha = score;
+    if (alpha >= beta) {
+      STAT_INC(thread, cutoffs);
+      STAT_ADD(thread, firstCutoffs, m == 0);
+      rewardMove(thread, ply, depth, side, cell);
+      break;
+    }
+  }
+
+  int bound;
+  if (bestScore <= alphaOrig)
+    bound = BOUND_UPPER;
+  else if (bestScore >= beta)
+    bound = BOUND_LOWER;
+  else
+    bound = BOUND_EXACT;
+  tt_store(key, depth, bound, scoreToTT(bestScore, ply),
+           symCell[sym][bestCell]);
+  return bestScore;
+}
+
+// Calculate adaptive search depth based on game state
 int getAdaptiveDepth(int moveNo) {
   // Very early game (first 4 moves): use shallow depth for speed
   if (moveNo < 4) {
     return 3; // Very fast for opening moves
   }
-  // Early game (4-8 moves): increase quickly
-  else if (moveNo < 8) {
-    return 5;
+  // Early game (4-8 moves): increase quickly
+  else if (moveNo < 8) {
+    return 5;
+  }
+  // Mid game (8-12 moves): near full depth
+  else if (moveNo < 12) {
+    return game->searchDepth - 1; // One less than user setting
+  }
+  // Late game (12+ moves): use maximum depth
+  else {
+    return game->searchDepth;
+  }
+}
+
+// Search every root move of side to depth with the root window
+// [alpha, beta] on the thread pool, writing each score back into moves.
+// Returns 0 if the deadline (monotonic ms, -1 for none) passed first or the
+// search was stopped; the scores are then incomplete.
+int searchRoot(const Board *root, int side, ScoredMove *moves, int moveCount,
+               int depth, int alpha, int beta, long long deadline) {
+  // Hand the root search to worker 0
+  pthread_mutex_lock(&pool->mutex);
+  pool->root = *root;
+  pool->side = side;
+  pool->depth = depth;
+  pool->alpha = alpha;
+  pool->beta = beta;
+  memcpy(pool->rootMoves, moves, moveCount * sizeof(ScoredMove));
+  pool->rootMoveCount = moveCount;
+  pool->jobPending = 1;
+  pthread_cond_broadcast(&pool->work_available);
+  pthread_mutex_unlock(&pool->mutex);
+
+  // Wait for the search to complete, or stop the workers at the deadline
+  if (deadline < 0) {
+    threadPool_wait();
+  } else if (!threadPool_waitUntil(deadline)) {
+    atomic_store(&pool->stop, 1);
+    threadPool_wait();
+  }
+  int completed = !atomic_load(&pool->stop);
+
+  for (int i = 0; i < moveCount; i++) {
+    moves[i].score = pool->rootMoves[i].score;
+    TRACE(TRACE_ROOT_MOVE, moves[i].cell, moves[i].score);
+  }
+
+  return completed;
+}
+
+// Cells where a stone would leave the attacker with a cell completing a
+// line: within WIN_LENGTH - 1 cells of an own stone along a line, tested one
+// by one
+Bitboard threatMoves(Bitboard stones, Bitboard empty) {
+  Bitboard reach = BB_NONE;
+  for (int d = 0; d < 4; d++) {
+    int s = lineDirs[d];
+    for (int k = 1; k < WIN_LENGTH; k++)
+      reach = bbOr(reach, bbOr(bbShl(stones, k * s), bbShr(stones, k * s)));
+  }
+
+  Bitboard moves = BB_NONE;
+  for (Bitboard pending = bbAnd(reach, empty); bbAny(pending);) {
+    int cell = bbPopLsb(&pending);
+    if (bbAny(winningCells(bbOr(stones, bbBit(cell)),
+                           bbAndNot(empty, bbBit(cell)))))
+      moves = bbOr(moves, bbBit(cell));
+  }
+  return moves;
+}
+
+// Threat-space search: can the attacker, to move, win by a sequence of
+// threats to complete a line, each of which leaves the defender a single
+// reply? A move that leaves two such cells (an open three or two crossing
+// lines) is a fork and wins outright. The defender's forced replies may
+// threaten in turn; the attacker may answer with a block only if it
+// threatens as well. Returns 1 and the first move in *winMove when a win
+// is proved; 0 when there is none or *budget nodes ran out.
+int threatSearch(Board *board, int attacker, int depth, int *budget,
+                 int *winMove) {
+  int defender = 1 - attacker;
+  Bitboard empty = boardEmpty(board);
+
+  Bitboard wins = winningCells(board->stones[attacker], empty);
+  if (bbAny(wins)) {
+    *winMove = bbLsb(wins);
+    return 1;
+  }
+  if (depth <= 0 || --*budget < 0)
+    return 0;
+
+  // A defender threat must be blocked, and two cannot be
+  Bitboard threats = winningCells(board->stones[defender], empty);
+  if (bbMany(threats))
+    return 0;
+  Bitboard moves = bbAny(threats)
+                       ? threats
+                       : threatMoves(board->stones[attacker], empty);
+
+  while (bbAny(moves)) {
+    int cell = bbPopLsb(&moves);
+    placeStone(board, cell, attacker);
+    Bitboard next = winningCells(board->stones[attacker],
+                                 bbAndNot(empty, bbBit(cell)));
+    int proved = 0;
+    if (bbMany(next)) {
+      proved = 1;
+    } else if (bbAny(next)) {
+      int reply = bbLsb(next);
+      int unused;
+      placeStone(board, reply, defender);
+      proved = threatSearch(board, attacker, depth - 1, budget, &unused);
+      removeStone(board, reply, defender);
+    }
+    removeStone(board, cell, attacker);
+    if (proved) {
+      *winMove = cell;
+      return 1;
+    }
+    if (*budget < 0)
+      return 0;
+  }
+  return 0;
+}
+
+// Monte Carlo tree search (--mcts): UCT over one tree shared by all the
+// workers. A worker walks down by the UCT formula, adding a visit to every
+// node on its way; until its result is backed up that visit counts as a
+// loss (a virtual loss), which steers the other workers to other moves. A
+// leaf is expanded into its candidate moves by the first worker to claim
+// it, and a playout finishes the game from there on bitboards: a winning
+// cell is played, a single threat is blocked, two threats lose, and any
+// other move is a random candidate cell. Nodes come from one preallocated
+// array, claimed a node's children at a time.
+typedef struct MctsNode {
+  atomic_int visits;
+  atomic_int wins;     // Half points (win 2, draw 1) of the side that moved
+  atomic_int children; // First child; 0: a leaf, -1: claimed or never split
+  int16_t cell;        // The move that led here
+  int16_t childCount;  // Set before children is published
+} MctsNode;
+
+typedef struct MctsTree {
+  MctsNode *nodes;        // nodes[0] is the root
+  atomic_int used;        // Nodes handed out
+  atomic_llong playouts;  // Left in the budget
+  atomic_int done;        // Set by worker 0: the tree is no longer searched
+  atomic_int active;      // Workers in mctsWorker()
+  atomic_int maxDepth;    // Deepest tree node reached
+} MctsTree;
+
+MctsTree mcts;
+
+static inline uint64_t mctsRandom(uint64_t *state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545F4914F6CDD1DULL;
+}
+
+// Cells within opts.radius of a stone
+static inline Bitboard mctsCandidates(Bitboard stones) {
+  Bitboard cells = BB_NONE;
+  while (bbAny(stones))
+    cells = bbOr(cells, neighborhood[bbPopLsb(&stones)]);
+  return cells;
+}
+
+// Play the game out from stones, side to move; the winner, or -1 for a draw
+int mctsRollout(SearchThread *thread, Bitboard stones[2], int side) {
+  Bitboard empty = bbAndNot(boardMask, bbOr(stones[0], stones[1]));
+  Bitboard near = bbAnd(mctsCandidates(bbOr(stones[0], stones[1])), empty);
+  while (bbAny(empty)) {
+    if (bbAny(winningCells(stones[side], empty)))
+      return side;
+    Bitboard threats = winningCells(stones[1 - side], empty);
+    if (bbMany(threats))
+      return 1 - side;
+    int cell;
+    if (bbAny(threats)) {
+      cell = bbLsb(threats);
+    } else {
+      Bitboard moves = bbAny(near) ? near : empty;
+      uint64_t r = mctsRandom(&thread->rng) >> 32;
+      cell = bbNth(moves, (int)((r * (uint64_t)bbCount(moves)) >> 32));
+    }
+    stones[side] = bbOr(stones[side], bbBit(cell));
+    empty = bbAndNot(empty, bbBit(cell));
+    near = bbAnd(bbOr(near, neighborhood[cell]), empty);
+    side = 1 - side;
+    thread->nodes++;
+  }
+  return -1;
+}
+
+// Give the leaf its candidate moves as children, unless another worker has
+// claimed it or the node array is full (then it stays a leaf)
+void mctsExpand(MctsNode *node, Bitboard stones[2]) {
+  int expected = 0;
+  if (!atomic_compare_exchange_strong(&node->children, &expected, -1))
+    return;
+  Bitboard occupied = bbOr(stones[0], stones[1]);
+  Bitboard empty = bbAndNot(boardMask, occupied);
+  Bitboard moves = candidateMoves(mctsCandidates(occupied), empty);
+  int count = bbCount(moves);
+  int first = atomic_fetch_add(&mcts.used, count);
+  if (count == 0 || first + count > MCTS_NODES)
+    return;
+  for (int i = 0; i < count; i++) {
+    MctsNode *child = &mcts.nodes[first + i];
+    atomic_init(&child->visits, 0);
+    atomic_init(&child->wins, 0);
+    atomic_init(&child->children, 0);
+    child->cell = (int16_t)bbPopLsb(&moves);
+  }
+  node->childCount = (int16_t)count;
+  atomic_store_explicit(&node->children, first, memory_order_release);
+}
+
+// One descent, expansion, playout and backup
+void mctsIterate(SearchThread *thread) {
+  int path[CELLS + 1];
+  int length = 1;
+  Bitboard stones[2] = {pool->root.stones[0], pool->root.stones[1]};
+  int side = pool->side;
+  int winner = -1;
+  MctsNode *node = &mcts.nodes[0];
+  path[0] = 0;
+  atomic_fetch_add(&node->visits, 1);
+
+  while (1) {
+    Bitboard empty = bbAndNot(boardMask, bbOr(stones[0], stones[1]));
+    if (!bbAny(empty))
+      break;
+    int first = atomic_load_explicit(&node->children, memory_order_acquire);
+    if (first <= 0) {
+      if (first == 0 && atomic_load(&node->visits) >= MCTS_EXPAND_VISITS)
+        mctsExpand(node, stones);
+      winner = mctsRollout(thread, stones, side);
+      break;
+    }
+
+    // UCT, visits in flight counting as losses
+    double logVisits = log((double)atomic_load(&node->visits));
+    int best = first;
+    double bestValue = -1;
+    for (int i = first; i < first + node->childCount; i++) {
+      int visits = atomic_load_explicit(&mcts.nodes[i].visits,
+                                        memory_order_relaxed);
+      if (visits == 0) {
+        best = i;
+        break;
+      }
+      double wins = atomic_load_explicit(&mcts.nodes[i].wins,
+                                         memory_order_relaxed);
+      double value = wins / (2.0 * visits) +
+                     MCTS_EXPLORATION * sqrt(logVisits / visits);
+      if (value > bestValue) {
+        bestValue = value;
+        best = i;
+      }
+    }
+
+    node = &mcts.nodes[best];
+    atomic_fetch_add(&node->visits, 1);
+    path[length++] = best;
+    thread->nodes++;
+    int won = bbTest(winningCells(stones[side], empty), node->cell);
+    stones[side] = bbOr(stones[side], bbBit(node->cell));
+    if (won) {
+      winner = side;
+      break;
+    }
+    side = 1 - side;
+  }
+
+  // The root was reached by the other side's move, its children by ours
+  for (int i = 0; i < length; i++) {
+    int mover = (i % 2) ? pool->side : 1 - pool->side;
+    int points = winner == mover ? 2 : winner < 0 ? 1 : 0;
+    if (points)
+      atomic_fetch_add_explicit(&mcts.nodes[path[i]].wins, points,
+                                memory_order_relaxed);
+  }
+  int deepest = atomic_load_explicit(&mcts.maxDepth, memory_order_relaxed);
+  while (length - 1 > deepest &&
+         !atomic_compare_exchange_weak(&mcts.maxDepth, &deepest, length - 1)) {
+  }
+}
+
+// Run playouts until the budget is spent or the search is stopped. Worker 0
+// then waits for the others to leave the tree before the search ends.
+void mctsWorker(SearchThread *thread) {
+  atomic_fetch_add(&mcts.active, 1);
+  while (!atomic_load_explicit(&mcts.done, memory_order_relaxed) &&
+         !atomic_load_explicit(&pool->stop, memory_order_relaxed) &&
+         atomic_fetch_sub_explicit(&mcts.playouts, 1, memory_order_relaxed) >
+             0) {
+    mctsIterate(thread);
+  }
+  atomic_fetch_sub(&mcts.active, 1);
+  if (thread->id == 0) {
+    atomic_store(&mcts.done, 1);
+    while (atomic_load(&mcts.active))
+      sched_yield();
+  }
+}
+
+// The most visited root move, its win rate as a score
+SearchResult mctsResult(long long start) {
+  SearchResult result = {NO_MOVE, 0, 0, 0, 0};
+  MctsNode *root = &mcts.nodes[0];
+  int first = atomic_load(&root->children);
+  int bestVisits = -1;
+  for (int i = first; i < first + root->childCount; i++) {
+    int visits = atomic_load(&mcts.nodes[i].visits);
+    if (visits > bestVisits) {
+      bestVisits = visits;
+      result.cell = mcts.nodes[i].cell;
+      result.score =
+          visits ? (int)(1000.0 * atomic_load(&mcts.nodes[i].wins) / visits) -
+                       1000
+                 : 0;
+    }
+  }
+  result.depth = atomic_load(&mcts.maxDepth);
+  result.nodes = threadPool_nodes();
+  result.timeMs = nowMs() - start;
+  return result;
+}
+
+// Tree search of root's moves on the pool, for as many playouts as the
+// depth limit stands for or until the deadline or a stop
+SearchResult mctsSearch(const Board *root, int side, const ScoredMove *moves,
+                        int moveCount, const SearchLimits *limits,
+                        long long start, long long deadline) {
+  if (!mcts.nodes) {
+    mcts.nodes = malloc(MCTS_NODES * sizeof(MctsNode));
+    if (!mcts.nodes) {
+      perror("alloc search tree");
+      exit(1);
+    }
+  }
+
+  // The root's children are the root moves, which may have been narrowed
+  // down to the defenses against a forced line
+  MctsNode *top = &mcts.nodes[0];
+  atomic_init(&top->visits, 0);
+  atomic_init(&top->wins, 0);
+  top->childCount = (int16_t)moveCount;
+  atomic_init(&top->children, 1);
+  for (int i = 0; i < moveCount; i++) {
+    MctsNode *child = &mcts.nodes[1 + i];
+    atomic_init(&child->visits, 0);
+    atomic_init(&child->wins, 0);
+    atomic_init(&child->children, 0);
+    child->cell = (int16_t)moves[i].cell;
+  }
+  atomic_store(&mcts.used, 1 + moveCount);
+  atomic_store(&mcts.playouts, limits->depth > 0 ? MCTS_PLAYOUTS(limits->depth)
+                                                 : LLONG_MAX);
+  atomic_store(&mcts.done, 0);
+  atomic_store(&mcts.active, 0);
+  atomic_store(&mcts.maxDepth, 1);
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->root = *root;
+  pool->side = side;
+  pool->mcts = 1;
+  pool->jobPending = 1;
+  pthread_cond_broadcast(&pool->work_available);
+  pthread_mutex_unlock(&pool->mutex);
+
+  // Report the leading move as the search goes
+  while (1) {
+    long long next = nowMs() + MCTS_REPORT_MS;
+    if (deadline >= 0 && deadline < next)
+      next = deadline;
+    if (threadPool_waitUntil(next))
+      break;
+    if (deadline >= 0 && nowMs() >= deadline) {
+      atomic_store(&pool->stop, 1);
+      threadPool_wait();
+      break;
+    }
+    if (limits->report) {
+      SearchResult progress = mctsResult(start);
+      limits->report(&progress);
+    }
+  }
+  pool->mcts = 0;
+
+  SearchResult result = mctsResult(start);
+  TRACE(TRACE_MCTS_RESULT, result.cell, result.score,
+        atomic_load(&top->visits), atomic_load(&mcts.used));
+  if (limits->report)
+    limits->report(&result);
+  return result;
+}
+
+// Persistent search cache: a file of completed root search results, keyed
+// by position and side to move, that outlives the process. It is mapped
+// shared, so results land in the file as they are stored and other
+// processes using it see them. Entries are checked like the TT's (key XOR
+// data), which keeps concurrent writers from producing a torn entry that
+// looks valid. The header carries CACHE_VERSION and a signature of the
+// evaluation tables, and a file that matches neither is started over.
+typedef struct CacheHeader {
+  char magic[8];      // "ZGCACHE"
+  uint32_t version;   // CACHE_VERSION
+  uint32_t variant;   // N << 16 | M << 8 | WIN_LENGTH
+  uint64_t keyCheck;  // A Zobrist key, as in BookHeader
+  uint64_t evalCheck; // evalSignature() of the build that wrote the results
+  uint64_t entries;   // CACHE_ENTRIES
+} CacheHeader;
+
+typedef struct CacheEntry {
+  uint64_t check; // Key XOR data
+  uint64_t data;  // Score, depth and move, packed as by cache_pack()
+} CacheEntry;
+
+typedef struct SearchCache {
+  CacheEntry *entries; // NULL: no cache
+  uint64_t mask;       // Of the first entry of a bucket
+} SearchCache;
+
+SearchCache cache;
+
+// FNV-1a over the line score tables: any change to the evaluation changes it
+uint64_t evalSignature(void) {
+  uint64_t hash = 14695981039346656037ull;
+  for (int len = 1; len <= LINE_TABLE_MAX && len <= MAX_LINE; len++) {
+    for (uint32_t code = 0; code < pow3[len]; code++) {
+      hash = (hash ^ (uint16_t)lineTable[len][code]) * 1099511628211ull;
+    }
+  }
+  return hash;
+}
+
+void cacheHeaderInit(CacheHeader *header) {
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, "ZGCACHE", 7);
+  header->version = CACHE_VERSION;
+  header->variant = N << 16 | M << 8 | WIN_LENGTH;
+  header->keyCheck = zobrist[1][CELL(N - 1, M - 1)][SYMMETRIES - 1];
+  header->evalCheck = evalSignature();
+  header->entries = CACHE_ENTRIES;
+}
+
+// Map the cache file at path, creating it, or starting it over when it was
+// written by a build whose results don't apply; 0 on failure
+int cacheOpen(const char *path) {
+  size_t size = sizeof(CacheHeader) + CACHE_ENTRIES * sizeof(CacheEntry);
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    perror(path);
+    return 0;
+  }
+  struct stat st;
+  CacheHeader expected, found;
+  cacheHeaderInit(&expected);
+  int valid = fstat(fd, &st) == 0 && (size_t)st.st_size == size &&
+              pread(fd, &found, sizeof(found), 0) == sizeof(found) &&
+              memcmp(&found, &expected, sizeof(found)) == 0;
+  if (!valid) {
+    if (st.st_size > 0)
+      fprintf(stderr, "%s: written by another build or evaluation, starting "
+                      "over\n",
+              path);
+    // Truncating to 0 first zeroes the entries
+    if (ftruncate(fd, 0) < 0 || ftruncate(fd, size) < 0 ||
+        pwrite(fd, &expected, sizeof(expected), 0) != sizeof(expected)) {
+      perror(path);
+      close(fd);
+      return 0;
+    }
+  }
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror(path);
+    return 0;
+  }
+  cache.entries = (CacheEntry *)((CacheHeader *)map + 1);
+  cache.mask = CACHE_ENTRIES - CACHE_BUCKET_SIZE;
+  return 1;
+}
+
+// Results are keyed on the radius and symmetry too: a search of fewer
+// candidate moves is not an answer to the same depth with more, and one
+// that merged symmetric positions in the table is only close to an exact
+// one. Both can change between searches (setoption), so they are part of
+// every key rather than of the header.
+static inline uint64_t cacheKey(const Board *board, int side) {
+  return board->hash[0] ^ (side ? 0x9e3779b97f4a7c15ull : 0) ^
+         (uint64_t)opts.radius * 0xc2b2ae3d27d4eb4full ^
+         (opts.symmetry ? 0x165667b19e3779f9ull : 0);
+}
+
+static inline uint64_t cache_pack(const SearchResult *result) {
+  return (uint64_t)(uint16_t)(result->score + 32768) |
+         (uint64_t)(result->depth & 0xFF) << 16 |
+         (uint64_t)(uint16_t)result->cell << 24;
+}
+
+// A stored result for side to move in board, if there is one
+int cacheProbe(const Board *board, int side, SearchResult *result) {
+  if (!cache.entries)
+    return 0;
+  uint64_t key = cacheKey(board, side);
+  CacheEntry *bucket = &cache.entries[key & cache.mask];
+  for (int i = 0; i < CACHE_BUCKET_SIZE; i++) {
+    uint64_t data = __atomic_load_n(&bucket[i].data, __ATOMIC_RELAXED);
+    uint64_t check = __atomic_load_n(&bucket[i].check, __ATOMIC_RELAXED);
+    if (data && (check ^ data) == key) {
+      SearchResult found = {(uint16_t)(data >> 24),
+                            (int)(data & 0xFFFF) - 32768,
+                            (int)((data >> 16) & 0xFF), 0, 0};
+      *result = found;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Keep result unless the cache has a deeper one for the position; replaces
+// the shallowest entry of the bucket otherwise
+void cacheStore(const Board *board, int side, const SearchResult *result) {
+  if (!cache.entries)
+    return;
+  uint64_t key = cacheKey(board, side);
+  CacheEntry *bucket = &cache.entries[key & cache.mask];
+  CacheEntry *victim = &bucket[0];
+  int victimDepth = 1 << 30;
+  for (int i = 0; i < CACHE_BUCKET_SIZE; i++) {
+    uint64_t data = __atomic_load_n(&bucket[i].data, __ATOMIC_RELAXED);
+    uint64_t check = __atomic_load_n(&bucket[i].check, __ATOMIC_RELAXED);
+    int depth = data ? (int)((data >> 16) & 0xFF) : -1;
+    if (data && (check ^ data) == key) {
+      if (depth > result->depth)
+        return;
+      victim = &bucket[i];
+      break;
+    }
+    if (depth < victimDepth) {
+      victimDepth = depth;
+      victim = &bucket[i];
+    }
+  }
+  uint64_t data = cache_pack(result);
+  __atomic_store_n(&victim->data, data, __ATOMIC_RELAXED);
+  __atomic_store_n(&victim->check, key ^ data, __ATOMIC_RELAXED);
+}
+
+// Search position for side to move within limits on the thread pool. The
+// caller clears pool->stop first; setting it from another thread ends the
+// search early with the best move of the last completed iteration.
+SearchResult searchPositionUntraced(const Board *position, int side,
+                                    const SearchLimits *limits) {
+  SearchResult result = {NO_MOVE, 0, 0, 0, 0};
+  long long start = nowMs();
+  int maxDepth = limits->depth > 0 && limits->depth < MAX_DEPTH ? limits->depth
+                                                                 : MAX_DEPTH;
+  long long deadline = limits->moveTimeMs ? start + limits->moveTimeMs : -1;
+  if (!limits->keepGeneration)
+    tt.generation++;
+
+  Board root = *position;
+  Bitboard empty = boardEmpty(&root);
+  if (!bbAny(empty) || hasLine(root.stones[0]) || hasLine(root.stones[1]))
+    return result;
+
+  // First pass: check for immediate winning moves
+  Bitboard wins = winningCells(root.stones[side], empty);
+  if (bbAny(wins)) {
+    result.cell = bbLsb(wins);
+    result.score = WIN_SCORE - 1;
+    TRACE(TRACE_WIN, result.cell);
+    if (limits->report)
+      limits->report(&result);
+    return result;
+  }
+
+  // Forced lines for both sides, beyond the horizon of the full-width
+  // search: play our own at once, and answer the opponent's only with moves
+  // that refute it
+  int budget = THREAT_NODES;
+  int threatCell;
+  if (threatSearch(&root, side, THREAT_MAX_DEPTH, &budget, &threatCell)) {
+    result.cell = threatCell;
+    result.score = WIN_SCORE - MAX_PLY;
+    result.timeMs = nowMs() - start;
+    TRACE(TRACE_FORCED_WIN, threatCell, THREAT_NODES - budget);
+    if (limits->report)
+      limits->report(&result);
+    return result;
+  }
+
+  empty = candidateMoves(candidateCells(&root), empty);
+  budget = THREAT_NODES;
+  if (threatSearch(&root, 1 - side, THREAT_MAX_DEPTH, &budget, &threatCell)) {
+    Bitboard defenses = BB_NONE;
+    for (Bitboard pending = empty; bbAny(pending);) {
+      int cell = bbPopLsb(&pending);
+      placeStone(&root, cell, side);
+      budget = THREAT_DEFENSE_NODES;
+      if (!threatSearch(&root, 1 - side, THREAT_MAX_DEPTH, &budget,
+                        &threatCell))
+        defenses = bbOr(defenses, bbBit(cell));
+      removeStone(&root, cell, side);
+    }
+    TRACE(TRACE_FORCED_LINE, bbCount(defenses));
+    if (bbAny(defenses))
+      empty = defenses;
+  }
+
+  // Second pass: parallel evaluation of the candidate moves
+  // Order root moves by heuristic score (move ordering for better pruning)
+  ScoredMove rootMoves[MAX_MOVES];
+  int moveCount = 0;
+  while (bbAny(empty)) {
+    int cell = bbPopLsb(&empty);
+    rootMoves[moveCount].cell = cell;
+    rootMoves[moveCount].score = childScore(&root, side, cell);
+    moveCount++;
+  }
+  qsort(rootMoves, moveCount, sizeof(ScoredMove), compareScoredMovesMax);
+
+  // Iterative deepening: each completed iteration re-orders the root moves
+  // for the next one. An iteration cut short by the deadline is thrown away
+  // and the move from the last completed depth is played.
+  int bestCell = rootMoves[0].cell;
+  int bestScore = rootMoves[0].score;
+  for (int i = 0; i < pool->threadCount; i++) {
+    SearchThread *thread = &pool->workers[i];
+    thread->nodes = 0;
+    memset(&thread->stats, 0, sizeof(thread->stats));
+    // History from the previous move is still a good guess, but a weaker
+    // one than what this search will learn
+    for (int c = 0; c < CELLS && !limits->keepGeneration; c++) {
+      thread->history[0][c] /= 2;
+      thread->history[1][c] /= 2;
+    }
+  }
+
+  if (opts.mcts)
+    return mctsSearch(&root, side, rootMoves, moveCount, limits, start,
+                      deadline);
+
+  // An earlier search of this position, maybe in an earlier session, that
+  // went at least as deep as this one may, or proved the result
+  SearchResult cached;
+  if (cacheProbe(&root, side, &cached)) {
+    int proven = cached.score >= WIN_SCORE - MAX_PLY ||
+                 cached.score <= -WIN_SCORE + MAX_PLY;
+    int legal = 0;
+    for (int i = 0; i < moveCount; i++)
+      legal |= rootMoves[i].cell == cached.cell;
+    if (legal && (proven || (limits->depth > 0 && cached.depth >= maxDepth))) {
+      cached.timeMs = nowMs() - start;
+      TRACE(TRACE_CACHED, cached.cell, cached.depth);
+      if (limits->report)
+        limits->report(&cached);
+      return cached;
+    }
+  }
+
+  for (int depth = 1; depth <= maxDepth; depth++) {
+    // Aspiration window around the previous score, widened on failure
+    int delta = ASPIRATION_WINDOW;
+    int alpha = depth > 1 ? bestScore - delta : -INF_SCORE;
+    int beta = depth > 1 ? bestScore + delta : INF_SCORE;
+    int completed;
+    int iterBest;
+
+    TRACE(TRACE_DEPTH_BEGIN, depth);
+    while (1) {
+      completed = searchRoot(&root, side, rootMoves, moveCount, depth, alpha,
+                             beta, deadline);
+      if (!completed)
+        break;
+
+      iterBest = pool->bestScore;
+      if (iterBest <= alpha && alpha > -INF_SCORE) {
+        alpha = alpha - delta > -INF_SCORE ? alpha - delta : -INF_SCORE;
+      } else if (iterBest >= beta && beta < INF_SCORE) {
+        beta = beta + delta < INF_SCORE ? beta + delta : INF_SCORE;
+      } else {
+        break;
+      }
+      delta *= 2;
+      TRACE(TRACE_ASPIRATION, depth, alpha, beta);
+    }
+    TRACE(TRACE_DEPTH_END, depth, pool->bestCell, pool->bestScore, completed);
+
+    if (!completed)
+      break;
+
+    // Best move first, then the others by their (bound) scores
+    bestCell = pool->bestCell;
+    bestScore = pool->bestScore;
+    for (int i = 0; i < moveCount; i++) {
+      if (rootMoves[i].cell == bestCell) {
+        ScoredMove best = rootMoves[i];
+        rootMoves[i] = rootMoves[0];
+        rootMoves[0] = best;
+        break;
+      }
+    }
+    qsort(rootMoves + 1, moveCount - 1, sizeof(ScoredMove),
+          compareScoredMovesMax);
+
+    result.depth = depth;
+    result.cell = bestCell;
+    result.score = bestScore;
+    result.nodes = threadPool_nodes();
+    result.timeMs = nowMs() - start;
+    if (limits->report)
+      limits->report(&result);
+
+    // A forced result will not change with more depth
+    if (bestScore >= WIN_SCORE - MAX_PLY || bestScore <= -WIN_SCORE + MAX_PLY)
+      break;
+    // The next iteration costs several times this one: don't start it
+    // unless it has a fair chance to finish
+    if (deadline >= 0 && nowMs() - start > limits->moveTimeMs / 2)
+      break;
+  }
+
+  result.cell = bestCell;
+  result.score = bestScore;
+  result.nodes = threadPool_nodes();
+  result.timeMs = nowMs() - start;
+  if (result.depth > 0)
+    cacheStore(&root, side, &result);
+  return result;
+}
+
+// searchPositionUntraced() as one span of the calling thread's trace; the
+// writer saves the search's records as soon as it ends
+SearchResult searchPosition(const Board *position, int side,
+                            const SearchLimits *limits) {
+  TRACE(TRACE_SEARCH_BEGIN, limits->depth, limits->moveTimeMs);
+  SearchResult result = searchPositionUntraced(position, side, limits);
+  TRACE(TRACE_SEARCH_END, result.cell, result.score, result.depth);
+  traceFlush();
+  return result;
+}
+
+// Pondering: while the human thinks, a background thread searches the AI's
+// reply to each of the human's candidate moves, all of them to one depth
+// before any goes deeper, the moves the heuristic likes best first. The best
+// reply to every move is kept by cell and the transposition table keeps the
+// trees under them, so the AI answers a pondered move at once or carries on
+// from its tree.
+typedef struct Ponder {
+  Board board; // Position with the human to move
+  int maxDepth;
+  pthread_t searcher;
+  int searching;       // searcher has been started and not joined yet
+  atomic_int stop;     // Set by ponderStop()
+  atomic_int depth;    // Depth the replies are being searched to
+  atomic_int done;     // Replies searched to that depth
+  atomic_int count;    // Candidate moves of the human
+  atomic_int finished; // Every reply searched to maxDepth
+  SearchResult replies[CELLS]; // Best reply to each human move
+  int ready[CELLS]; // Depth replies[cell] holds; MAX_DEPTH once it is final
+} Ponder;
+
+Ponder ponder;
+
+void *ponderSearch(void *arg) {
+  (void)arg;
+  Board board = ponder.board;
+  ScoredMove moves[MAX_MOVES];
+  int count = 0;
+  Bitboard pending = candidateMoves(candidateCells(&board), boardEmpty(&board));
+  while (bbAny(pending)) {
+    int cell = bbPopLsb(&pending);
+    moves[count].cell = cell;
+    moves[count].score = childScore(&board, 0, cell);
+    count++;
+  }
+  qsort(moves, count, sizeof(ScoredMove), compareScoredMovesMax);
+  atomic_store(&ponder.count, count);
+
+  // All the reply searches share one TT generation, so that they don't
+  // crowd each other's entries out
+  tt.generation++;
+  for (int depth = 1; depth <= ponder.maxDepth; depth++) {
+    atomic_store(&ponder.depth, depth);
+    atomic_store(&ponder.done, 0);
+    for (int i = 0; i < count; i++) {
+      int cell = moves[i].cell;
+      if (ponder.ready[cell] < depth) {
+        Board child = board;
+        makeMove(&child, cell, 0);
+        SearchLimits limits = {depth, 0, NULL, 1};
+        // ponderStop() raises both flags: check ours after clearing the pool's
+        atomic_store(&pool->stop, 0);
+        if (atomic_load(&ponder.stop))
+          return NULL;
+        SearchResult result = searchPosition(&child, 1, &limits);
+        if (atomic_load(&ponder.stop)) {
+          // Keep the deepest iteration the interrupted search completed
+          if (result.depth > ponder.ready[cell]) {
+            ponder.replies[cell] = result;
+            ponder.ready[cell] = result.depth;
+          }
+          return NULL;
+        }
+        ponder.replies[cell] = result;
+        // Decided without searching (a win, a forced line or a full board),
+        // or proven won or lost: more depth won't change it
+        int forced = result.score >= WIN_SCORE - MAX_PLY ||
+                     result.score <= -WIN_SCORE + MAX_PLY;
+        ponder.ready[cell] = result.depth && !forced ? result.depth : MAX_DEPTH;
+      }
+      atomic_fetch_add(&ponder.done, 1);
+      wakeUp();
+    }
+  }
+  atomic_store(&ponder.finished, 1);
+  wakeUp();
+  return NULL;
+}
+
+// Start pondering on the current position, the human to move
+void ponderStart(void) {
+  ponderStop();
+  boardFromGrid(game->grid, &ponder.board);
+  // The AI's next search goes to the adaptive depth of the next move, or as
+  // deep as its clock allows
+  ponder.maxDepth =
+      opts.moveTimeMs ? MAX_DEPTH : getAdaptiveDepth(game->moveNo + 1);
+  for (int c = 0; c < CELLS; c++) {
+    ponder.replies[c].cell = NO_MOVE;
+    ponder.ready[c] = 0;
+  }
+  atomic_store(&ponder.stop, 0);
+  atomic_store(&ponder.depth, 0);
+  atomic_store(&ponder.done, 0);
+  atomic_store(&ponder.count, 0);
+  atomic_store(&ponder.finished, 0);
+  pthread_create(&ponder.searcher, NULL, ponderSearch, NULL);
+  ponder.searching = 1;
+}
+
+// Stop pondering and wait for the searcher; the replies stay readable
+void ponderStop(void) {
+  if (!ponder.searching)
+    return;
+  atomic_store(&ponder.stop, 1);
+  atomic_store(&pool->stop, 1);
+  pthread_join(ponder.searcher, NULL);
+  ponder.searching = 0;
+}
+
+// The human move that turned the pondered position into root, or NO_MOVE
+int ponderMove(const Board *root) {
+  Bitboard added = bbAndNot(root->stones[0], ponder.board.stones[0]);
+  if (!bbAny(added) || bbMany(added))
+    return NO_MOVE;
+  int cell = bbLsb(added);
+  Board expected = ponder.board;
+  makeMove(&expected, cell, 0);
+  for (int s = 0; s < SYMMETRIES; s++)
+    if (expected.hash[s] != root->hash[s])
+      return NO_MOVE;
+  return cell;
+}
+
+// Opening book: buildBook() searches the positions of the first plies
+// deeply, offline, and writes the engine's move in each to a file of
+// BookEntry records sorted by key. bookOpen() maps the file and bookProbe()
+// binary-searches it. Positions are keyed by canonicalKey() and moves stored
+// in that orientation, so all mirror images of a position share one entry.
+typedef struct BookHeader {
+  char magic[8];    // "ZGBOOK"
+  uint32_t version; // BOOK_VERSION
+  uint32_t variant; // N << 16 | M << 8 | WIN_LENGTH
+  uint64_t keyCheck; // A Zobrist key: the book's keys are only valid with
+                     // the same ones
+  uint64_t count;   // Entries that follow
+} BookHeader;
+
+typedef struct BookEntry {
+  uint64_t key;
+  uint16_t move; // Cell, in the orientation of the key
+  int16_t score;
+  uint8_t depth;
+  uint8_t pad[3];
+} BookEntry;
+
+typedef struct Book {
+  const BookEntry *entries; // Sorted by key
+  uint64_t count;
+  void *map;
+  size_t size;
+} Book;
+
+Book book;
+
+void bookHeaderInit(BookHeader *header, uint64_t count) {
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, "ZGBOOK", 6);
+  header->version = BOOK_VERSION;
+  header->variant = N << 16 | M << 8 | WIN_LENGTH;
+  header->keyCheck = zobrist[1][CELL(N - 1, M - 1)][SYMMETRIES - 1];
+  header->count = count;
+}
+
+// Map a book built for this variant; 0 (with a message) if it is not one
+int bookOpen(const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    perror(path);
+    return 0;
+  }
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(BookHeader))
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "%s: not an opening book\n", path);
+    return 0;
+  }
+
+  BookHeader expected;
+  const BookHeader *header = map;
+  bookHeaderInit(&expected, header->count);
+  if (memcmp(header, &expected, sizeof(expected)) != 0 ||
+      header->count > (st.st_size - sizeof(BookHeader)) / sizeof(BookEntry)) {
+    fprintf(stderr,
+            "%s: not an opening book for this build and variant (%s)\n",
+            path, VARIANT_NAME);
+    munmap(map, st.st_size);
+    return 0;
+  }
+  book.entries = (const BookEntry *)(header + 1);
+  book.count = header->count;
+  book.map = map;
+  book.size = st.st_size;
+  return 1;
+}
+
+// The book's move for the side to move in board, if it has the position
+int bookProbe(const Board *board, SearchResult *result) {
+  int sym;
+  uint64_t key = canonicalKey(board, &sym);
+  uint64_t lo = 0, hi = book.count;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (book.entries[mid].key < key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == book.count || book.entries[lo].key != key)
+    return 0;
+
+  const BookEntry *entry = &book.entries[lo];
+  int cell = symCellInv[sym][entry->move];
+  if (!bbTest(boardEmpty(board), cell))
+    return 0; // A hash collision
+  SearchResult found = {cell, entry->score, entry->depth, 0, 0};
+  *result = found;
+  return 1;
+}
+
+// The AI's move is searched on its own thread so that the UI keeps drawing
+// and reading keys while it thinks. Each completed iteration is published
+// for draw(), and stopping the pool makes the AI play the best move found so
+// far.
+typedef struct AiSearch {
+  pthread_t searcher;
+  int searching;         // searcher has been started and not joined yet
+  atomic_int finished;   // searcher has stored its move
+  Pos move;              // The move, once finished
+  long long start;       // When the search started
+  pthread_mutex_t mutex; // Guards best
+  SearchResult best;     // Last completed iteration
+} AiSearch;
+
+AiSearch ai = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+void aiReport(const SearchResult *result) {
+  pthread_mutex_lock(&ai.mutex);
+  ai.best = *result;
+  pthread_mutex_unlock(&ai.mutex);
+  wakeUp();
+}
+
+// The last completed iteration of the running search
+SearchResult aiProgress(void) {
+  pthread_mutex_lock(&ai.mutex);
+  SearchResult best = ai.best;
+  pthread_mutex_unlock(&ai.mutex);
+  return best;
+}
+
+Pos aiPlay(void) {
+  Pos p = {-1, -1};
+
+  game->aiDepth = 0;
+  game->aiTimeMs = 0;
+  game->aiPondered = 0;
+  game->aiBooked = 0;
+
+  Board root;
+  boardFromGrid(game->grid, &root);
+  SearchResult booked;
+  if (bookProbe(&root, &booked)) {
+    p.x = booked.cell / CELL_STRIDE;
+    p.y = booked.cell % CELL_STRIDE;
+    game->aiDepth = booked.depth;
+    game->aiBooked = 1;
+    TRACE(TRACE_BOOK, booked.cell, booked.depth);
+    return p;
+  }
+
+  // Without a book, the first AI move (moveNo will be 1 if human played
+  // first) is one of the cells around the center
+  if (game->moveNo <= 1) {
+    // Try center column positions from middle outward
+    int centerCol = M / 2;
+    int positions[][2] = {
+        {N / 2, centerCol},     // Center
+        {N / 2 - 1, centerCol}, // Above center
+        {N / 2 + 1, centerCol}, // Below center
+        {N / 2, centerCol - 1}, // Left of center
+        {N / 2, centerCol + 1}  // Right of center
+    };
+
+    for (int i = 0; i < 5; i++) {
+      int row = positions[i][0];
+      int col = positions[i][1];
+      if (row >= 0 && row < N && col >= 0 && col < M &&
+          game->grid[row][col] == 0) {
+        p.x = row;
+        p.y = col;
+        TRACE(TRACE_BOOK, CELL(row, col), 0);
+        return p;
+      }
+    }
+  }
+
+  // Without a time budget, iterate up to the adaptive depth; with one, go as
+  // deep as the clock allows
+  SearchLimits limits = {
+      opts.moveTimeMs ? 0 : getAdaptiveDepth(game->moveNo), opts.moveTimeMs,
+      aiReport, 0};
+
+  // A reply pondered to the depth this search would reach is played as it
+  // is; otherwise the search starts over with the pondered tree in the TT
+  int pondered = ponderMove(&root);
+  int target = limits.depth ? limits.depth : MAX_DEPTH;
+  SearchResult result;
+  if (pondered != NO_MOVE && ponder.ready[pondered] >= target &&
+      ponder.replies[pondered].cell != NO_MOVE) {
+    result = ponder.replies[pondered];
+    game->aiPondered = 1;
+    memset(&game->aiStats, 0, sizeof(game->aiStats));
+    game->aiTimeMs = 0;
+    TRACE(TRACE_PONDERED, result.depth);
+  } else {
+    result = searchPosition(&root, 1, &limits);
+    game->aiTimeMs = result.timeMs;
+    threadPool_stats(&game->aiStats);
+    if (opts.statsFile)
+      writeStatsJson(opts.statsFile, &game->aiStats, &result);
+    // Out of time before catching up with the pondering
+    if (pondered != NO_MOVE && ponder.ready[pondered] > result.depth &&
+        ponder.replies[pondered].cell != NO_MOVE) {
+      result = ponder.replies[pondered];
+      game->aiPondered = 1;
+    }
+  }
+  if (result.cell == NO_MOVE)
+    return p;
+
+  p.x = result.cell / CELL_STRIDE;
+  p.y = result.cell % CELL_STRIDE;
+  game->aiDepth = result.depth;
+  return p;
+}
+
+void *aiSearch(void *arg) {
+  (void)arg;
+  TRACE(TRACE_AI_BEGIN, game->moveNo);
+  ai.move = aiPlay();
+  TRACE(TRACE_AI_END, ai.move.x >= 0 ? CELL(ai.move.x, ai.move.y) : NO_MOVE,
+        game->aiDepth);
+  atomic_store(&ai.finished, 1);
+  wakeUp();
+  return NULL;
+}
+
+// Start searching the AI's move on the current grid
+void aiStart(void) {
+  SearchResult none = {NO_MOVE, 0, 0, 0, 0};
+  aiReport(&none);
+  ai.start = nowMs();
+  atomic_store(&ai.finished, 0);
+  atomic_store(&pool->stop, 0);
+  pthread_create(&ai.searcher, NULL, aiSearch, NULL);
+  ai.searching = 1;
+}
+
+// Wait for the AI's move; with stop, cut the search short first
+Pos aiWait(int stop) {
+  Pos none = {-1, -1};
+  if (!ai.searching)
+    return none;
+  if (stop)
+    atomic_store(&pool->stop, 1);
+  pthread_join(ai.searcher, NULL);
+  ai.searching = 0;
+  return ai.move;
+}
+
+// Find and mark winning positions in the grid
+// Returns winning player (1 or 2), or 0 if no win
+// Marks winning cells in winMark array
+int findWinningSequence(int grid[N][M], int winMark[N][M]) {
+  memset(winMark, 0, N * M * sizeof(int));
+
+  // Check all positions for a line to the right, down or diagonally down
+  static const int dirs[4][2] = {{0, 1}, {1, 0}, {1, 1}, {1, -1}};
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j < M; j++) {
+      if (grid[i][j] == 0)
+        continue;
+
+      int player = grid[i][j];
+      for (int d = 0; d < 4; d++) {
+        int k = 1;
+        while (k < WIN_LENGTH) {
+          int x = i + k * dirs[d][0], y = j + k * dirs[d][1];
+          if (x < 0 || x >= N || y < 0 || y >= M || grid[x][y] != player)
+            break;
+          k++;
+        }
+        if (k == WIN_LENGTH) {
+          for (k = 0; k < WIN_LENGTH; k++)
+            winMark[i + k * dirs[d][0]][j + k * dirs[d][1]] = 1;
+          return player;
+        }
+      }
+    }
+  }
+
+  return 0;
+}
+
+int checkWin(int grid[N][M]) {
+  Board board;
+  boardFromGrid(grid, &board);
+  if (hasLine(board.stones[0]))
+    return 1;
+  if (hasLine(board.stones[1]))
+    return 2;
+  return 0;
+}
+
+// Recompute what depends on the grid alone, once per move rather than per
+// frame
+void gridChanged(void) { findWinningSequence(game->grid, game->winMark); }
+
+void setup(void) {
+  struct termios raw;
+
+  signal(SIGINT, signal_hander);
+  signal(SIGKILL, signal_hander);
+  signal(SIGTERM, signal_hander);
+
+  tcgetattr(STDIN_FILENO, &origterm);
+  raw = origterm;
+
+  raw.c_lflag &= ~(ICANON | ECHO); // Disable canonical and echo mode
+  raw.c_cc[VMIN] = 0;              // Not blocking
+  raw.c_cc[VTIME] = 0;             // No timeout
+
+  // Apply changes
+  tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+
+  atexit(teardown);
+
+  printf("%s%s%s", HIDE_CURSOR, CLEAR_SCREEN, REPOS_CURSOR);
+  fflush(stdout);
+
+  game = malloc(sizeof(Game));
+  memset(game->grid, 0, M * N * sizeof(int));
+  memset(game->input, 0, INPUT_BUF_LEN);
+  game->failedInput = 0;
+  game->won = 0;
+  game->moveNo = 0;
+  game->aiThinking = 0;
+  game->aiMove.x = -1;
+  game->aiMove.y = -1;
+  game->searchDepth = opts.searchDepth;
+  game->aiDepth = 0;
+  game->aiTimeMs = 0;
+  game->aiPondered = 0;
+  game->aiBooked = 0;
+  gridChanged();
+  screenValid = 0;
+
+  // Search threads and signal handlers wake the main loop through a pipe
+  if (wakeupFds[0] < 0 && pipe2(wakeupFds, O_NONBLOCK | O_CLOEXEC) < 0) {
+    perror("pipe2");
+    exit(1);
   }
-  // Mid game (8-12 moves): near full depth
-  else if (moveNo < 12) {
-    return game->searchDepth - 1; // One less than user setting
+
+  initBitboards();
+
+  // The transposition table survives restarts: positions are positions
+  if (!tt.buckets)
+    tt_init(opts.hashMb);
+
+  // Initialize thread pool (kept across restarts like the table)
+  if (!pool)
+    threadPool_init(configuredThreads());
+}
+
+// Play the AI's move once its search is done
+void aiFinish(void) {
+  Pos aiPos = aiWait(0);
+  game->aiThinking = 0;
+  if (aiPos.x < 0)
+    return;
+  game->grid[aiPos.x][aiPos.y] = 2;
+  gridChanged();
+
+  int winningPlayer = checkWin(game->grid);
+  if (winningPlayer) {
+    game->won = winningPlayer;
+    TRACE(TRACE_GAME_OVER, winningPlayer);
+  } else if (opts.ponder) {
+    ponderStart();
   }
-  // Late game (12+ moves): use maximum depth
-  else {
-    return game->searchDepth;
+}
+
+void handleKey(char c) {
+  Pos pos;
+  int moveDone = 0;
+
+  // While the AI thinks, <Enter> or <Space> makes it move now
+  if (game->aiThinking) {
+    if (c == '\n' || c == ' ')
+      atomic_store(&pool->stop, 1);
+    return;
+  }
+
+  // Reset vars
+  game->failedInput = 0;
+  game->invalidMove = 0;
+
+  switch (c) {
+  // Backwards to delete last char
+  case 127: {
+    int s = strlen(game->input);
+    if (s > 0) {
+      game->input[s - 1] = '\0';
+    }
+    break;
+  }
+  case '\n': {
+    if (game->won) {
+      setup();
+      return;
+    }
+    pos = parseInput();
+    moveDone = 1;
+    memset(game->input, 0, INPUT_BUF_LEN);
+    break;
+  }
+  default: {
+    int s = strlen(game->input);
+    if (s < INPUT_BUF_LEN - 1) {
+      game->input[s] = c;
+      game->input[s + 1] = '\0';
+    }
+  }
+  }
+
+  if (moveDone) {
+    if (!isValidMove(pos.x, pos.y, game->grid)) {
+      game->invalidMove = 1;
+      return;
+    }
+    ponderStop();
+    game->grid[pos.x][pos.y] = 1;
+    game->moveNo++;
+    gridChanged();
+
+    int winningPlayer = checkWin(game->grid);
+    if (winningPlayer) {
+      game->won = winningPlayer;
+      TRACE(TRACE_GAME_OVER, winningPlayer);
+      return;
+    }
+
+    // The AI thinks in the background; update() plays its move when done
+    game->aiThinking = 1;
+    aiStart();
   }
 }
 
-Pos aiPlay(void) {
-  Pos p = {-1, -1};
-  int bestScore = -10000;
+// Handle whatever happened since the last call: the AI's move, keys
+void update(void) {
+  char c;
+  if (game->aiThinking && atomic_load(&ai.finished))
+    aiFinish();
+  while (read(STDIN_FILENO, &c, 1) == 1)
+    handleKey(c);
+}
 
-  llog("\n=== AI's turn ===\n");
+// Sleep until a key is pressed or a search thread calls wakeUp(); while the
+// AI thinks, wake up anyway to redraw its clock
+void waitForEvent(void) {
+  struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0},
+                          {wakeupFds[0], POLLIN, 0}};
+  if (poll(fds, 2, game->aiThinking ? PROGRESS_MS : -1) > 0 &&
+      (fds[1].revents & POLLIN)) {
+    char buf[64];
+    while (read(wakeupFds[0], buf, sizeof(buf)) > 0) {
+    }
+  }
+}
 
-  // Opening book: first AI move (moveNo will be 1 if human played first)
-  if (game->moveNo <= 1) {
-    // Try center column positions from middle outward
-    int centerCol = M / 2;
-    int positions[][2] = {
-        {N / 2, centerCol},     // Center
-        {N / 2 - 1, centerCol}, // Above center
-        {N / 2 + 1, centerCol}, // Below center
-        {N / 2, centerCol - 1}, // Left of center
-        {N / 2, centerCol + 1}  // Right of center
-    };
+// Append text to the frame being drawn; '\n' starts the next line
+void framePrintf(const char *fmt, ...) {
+  char text[FRAME_LINE_LEN];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(text, sizeof(text), fmt, args);
+  va_end(args);
 
-    for (int i = 0; i < 5; i++) {
-      int row = positions[i][0];
-      int col = positions[i][1];
-      if (row >= 0 && row < N && col >= 0 && col < M &&
-          game->grid[row][col] == 0) {
-        p.x = row;
-        p.y = col;
-        llog("AI using opening book: position [%d][%d]\n", p.x, p.y);
-        return p;
+  if (frame.count == 0) {
+    frame.lines[0][0] = '\0';
+    frame.count = 1;
+  }
+  for (char *part = text; *part;) {
+    char *newline = strchr(part, '\n');
+    size_t length = newline ? (size_t)(newline - part) : strlen(part);
+    char *line = frame.lines[frame.count - 1];
+    size_t used = strlen(line);
+    if (length > FRAME_LINE_LEN - 1 - used)
+      length = FRAME_LINE_LEN - 1 - used;
+    memcpy(line + used, part, length);
+    line[used + length] = '\0';
+    if (!newline)
+      break;
+    if (frame.count < FRAME_LINES) {
+      frame.lines[frame.count][0] = '\0';
+      frame.count++;
+    }
+    part = newline + 1;
+  }
+}
+
+// Put the frame on the terminal: only the lines that differ from the
+// screen, or everything after a clear, in a single write()
+void framePresent(void) {
+  static char out[FRAME_LINES * (FRAME_LINE_LEN + 16) + 16];
+  size_t used = 0;
+  if (!screenValid) {
+    used += snprintf(out, sizeof(out), "%s", CLEAR_SCREEN);
+    screen.count = 0;
+  }
+  int lines = frame.count > screen.count ? frame.count : screen.count;
+  for (int i = 0; i < lines; i++) {
+    const char *text = i < frame.count ? frame.lines[i] : "";
+    if (i < screen.count && strcmp(text, screen.lines[i]) == 0)
+      continue;
+    used += snprintf(out + used, sizeof(out) - used, "\x1b[%d;1H%s\x1b[K",
+                     i + 1, text);
+  }
+  screen = frame;
+  screenValid = 1;
+
+  for (size_t done = 0; done < used;) {
+    ssize_t n = write(STDOUT_FILENO, out + done, used - done);
+    if (n <= 0)
+      break;
+    done += n;
+  }
+}
+
+void drawGrid(int grid[N][M], int winMark[N][M]) {
+  for (int j = 0; j < M && j < 26; j++) {
+    framePrintf("%c ", 'A' + j);
+  }
+  framePrintf("\n");
+  for (int i = 0; i < N; i++) {
+    framePrintf(" %02d |", i + 1);
+    for (int j = 0; j < M; j++) {
+      if (grid[i][j] == 0) {
+        framePrintf(" .");
+      } else {
+        // Determine color
+        const char *color;
+        if (winMark[i][j]) {
+          // Winning piece: black on white
+          color = COLOR_BLACK_ON_WHITE;
+        } else if (grid[i][j] == 1) {
+          // Player X: red bold
+          color = COLOR_RED_BOLD;
+        } else {
+          // Player O (AI): green bold
+          color = COLOR_GREEN_BOLD;
+        }
+
+        char piece = grid[i][j] == 1 ? 'X' : 'O';
+        framePrintf(" %s%c%s", color, piece, COLOR_RESET);
+      }
+    }
+    framePrintf("\n");
+  }
+}
+
+void draw(void) {
+  frame.count = 0;
+  framePrintf("\n      ");
+
+  drawGrid(game->grid, game->winMark);
+
+  framePrintf("\n");
+
+  if (game->won) {
+    framePrintf("You %s\nPress <Enter> to play again.",
+                game->won == 1 ? "won!" : "lose...");
+  } else if (game->aiThinking) {
+    if (opts.moveTimeMs) {
+      framePrintf("AI thinking (%d ms, %d threads)...\n", opts.moveTimeMs,
+                  pool->threadCount);
+    } else {
+      int adaptiveDepth = getAdaptiveDepth(game->moveNo);
+      framePrintf("AI thinking (depth %d, %d threads)...\n", adaptiveDepth,
+                  pool->threadCount);
+    }
+    // Live progress; game->ai* belong to the search until it is done
+    SearchResult best = aiProgress();
+    long long elapsed = nowMs() - ai.start;
+    uint64_t nodes = threadPool_nodes();
+    char move[16] = "-";
+    if (best.cell != NO_MOVE)
+      formatCell(best.cell, move, sizeof(move));
+    framePrintf(
+        "Depth %d, best %s (score %d), %llu nodes/s, %lld ms\n", best.depth,
+        move, best.score,
+        (unsigned long long)(nodes * 1000 / (elapsed > 0 ? elapsed : 1)),
+        elapsed);
+    framePrintf("Press <Enter> to make the AI move now.\n");
+  } else {
+    // Draw input buf
+    framePrintf("Your move: %s\n",
+                game->invalidMove
+                    ? "Invalid move, cell alreay set or out of bound."
+                    : (game->failedInput ? "Invalid input" : game->input));
+    if (opts.moveTimeMs) {
+      framePrintf("AI search time: %d ms per move\n", opts.moveTimeMs);
+    } else {
+      int adaptiveDepth = getAdaptiveDepth(game->moveNo);
+      framePrintf("AI search depth: %d (adaptive, max: %d)\n", adaptiveDepth,
+                  game->searchDepth);
+    }
+    if (game->aiBooked) {
+      framePrintf("Last AI move: from the opening book (depth %d)\n",
+                  game->aiDepth);
+    } else if (game->aiPondered) {
+      framePrintf("Last AI move: depth %d, found while you were thinking\n",
+                  game->aiDepth);
+    } else if (game->aiDepth > 0) {
+      char summary[160];
+      formatStatsSummary(&game->aiStats, game->aiTimeMs, summary,
+                         sizeof(summary));
+      framePrintf("Last AI move: depth %d reached in %lld ms\n%s\n",
+                  game->aiDepth, game->aiTimeMs, summary);
+    }
+    if (ponder.searching && atomic_load(&ponder.finished)) {
+      framePrintf("Pondering: done, replies to all %d moves at depth %d\n",
+                  atomic_load(&ponder.count), ponder.maxDepth);
+    } else if (ponder.searching) {
+      framePrintf("Pondering: replies to %d/%d moves at depth %d\n",
+                  atomic_load(&ponder.done), atomic_load(&ponder.count),
+                  atomic_load(&ponder.depth));
+    }
+  }
+  framePresent();
+}
+// Search one fixed position with 1, 2, 4, ... threads up to the configured
+// count and print how the search scales. Each run starts from an empty
+// transposition table so that they all do the same work. A single stone
+// keeps the game open long enough that the depth decides the cost.
+void scalingReport(void) {
+  static const int stones[][3] = {{4, 4, 1}};
+  int maxThreads = configuredThreads();
+  int counts[32];
+  int runs = 0;
+  for (int t = 1; t < maxThreads && runs < 31; t *= 2)
+    counts[runs++] = t;
+  counts[runs++] = maxThreads;
+
+  initBitboards();
+  Board board;
+  memset(&board, 0, sizeof(board));
+  for (size_t i = 0; i < sizeof(stones) / sizeof(stones[0]); i++)
+    makeMove(&board, CELL(stones[i][0], stones[i][1]), stones[i][2] - 1);
+  SearchLimits limits = {opts.searchDepth, 0, NULL, 0};
+
+  printf("Scaling report: depth %d, %d online CPUs%s\n", opts.searchDepth,
+         onlineCpus(), opts.pin ? ", pinned" : "");
+  printf("%8s %10s %12s %12s %8s %10s  %s\n", "threads", "time ms", "nodes",
+         "nps", "speedup", "efficiency", "depth/move");
+
+  double baseMs = 0;
+  for (int r = 0; r < runs; r++) {
+    tt_init(opts.hashMb);
+    threadPool_init(counts[r]);
+
+    long long start = nowMs();
+    atomic_store(&pool->stop, 0);
+    SearchResult result = searchPosition(&board, 1, &limits);
+    long long elapsed = nowMs() - start;
+    uint64_t nodes = result.nodes;
+    threadPool_destroy();
+
+    double ms = elapsed > 0 ? (double)elapsed : 1;
+    if (r == 0)
+      baseMs = ms;
+    double speedup = baseMs / ms;
+    printf("%8d %10lld %12llu %12.0f %8.2f %9.0f%%  %d %d:%d\n", counts[r],
+           elapsed, (unsigned long long)nodes, nodes * 1000.0 / ms, speedup,
+           100.0 * speedup / counts[r], result.depth,
+           result.cell / CELL_STRIDE, result.cell % CELL_STRIDE);
+    fflush(stdout);
+  }
+}
+
+// Headless engine mode: a UCI/GTP-like line protocol on stdin/stdout.
+// Moves are written column letter then row number, like the board labels
+// ("e5"); the first player's stones are side 0 and sides alternate from the
+// empty board. The search runs on its own thread so that "stop" and
+// "isready" are answered while it thinks.
+typedef struct Engine {
+  Board board;
+  int side; // Side to move
+  SearchLimits limits;
+  pthread_t searcher;
+  int searching; // searcher has been started and not joined yet
+} Engine;
+
+Engine engine;
+
+void engineReport(const SearchResult *result) {
+  char move[16];
+  char score[32];
+  formatCell(result->cell, move, sizeof(move));
+  if (result->score >= WIN_SCORE - MAX_PLY)
+    snprintf(score, sizeof(score), "win");
+  else if (result->score <= -WIN_SCORE + MAX_PLY)
+    snprintf(score, sizeof(score), "loss");
+  else
+    snprintf(score, sizeof(score), "%d", result->score);
+  long long ms = result->timeMs > 0 ? result->timeMs : 1;
+  printf("info depth %d score %s nodes %llu nps %llu time %lld pv %s\n",
+         result->depth, score, (unsigned long long)result->nodes,
+         (unsigned long long)(result->nodes * 1000 / ms), result->timeMs, move);
+  fflush(stdout);
+}
+
+void *engineSearch(void *arg) {
+  (void)arg;
+  SearchResult result;
+  int booked = bookProbe(&engine.board, &result);
+  if (booked) {
+    printf("info string book\n");
+    engineReport(&result);
+  } else {
+    result = searchPosition(&engine.board, engine.side, &engine.limits);
+  }
+  char move[16] = "none";
+  if (result.cell != NO_MOVE)
+    formatCell(result.cell, move, sizeof(move));
+  if (opts.statsFile && !booked) {
+    SearchStats stats;
+    threadPool_stats(&stats);
+    writeStatsJson(opts.statsFile, &stats, &result);
+  }
+  printf("bestmove %s\n", move);
+  fflush(stdout);
+  return NULL;
+}
+
+// Wait for the running search, if any; with stop, cut it short first
+void engineWait(int stop) {
+  if (!engine.searching)
+    return;
+  if (stop)
+    atomic_store(&pool->stop, 1);
+  pthread_join(engine.searcher, NULL);
+  engine.searching = 0;
+}
+
+// position [startpos] [moves] <move>...
+void enginePosition(char *args) {
+  memset(&engine.board, 0, sizeof(engine.board));
+  engine.side = 0;
+  for (char *tok = strtok(args, " \t"); tok; tok = strtok(NULL, " \t")) {
+    if (strcmp(tok, "startpos") == 0 || strcmp(tok, "moves") == 0)
+      continue;
+    int cell = parseCell(tok);
+    if (cell < 0 || !bbTest(boardEmpty(&engine.board), cell)) {
+      printf("info string illegal move %s, position cleared\n", tok);
+      memset(&engine.board, 0, sizeof(engine.board));
+      engine.side = 0;
+      return;
+    }
+    makeMove(&engine.board, cell, engine.side);
+    engine.side = 1 - engine.side;
+  }
+}
+
+// go [depth D] [movetime MS] [infinite]; with no limit, the default depth
+void engineGo(char *args) {
+  SearchLimits limits = {0, 0, engineReport, 0};
+  int infinite = 0;
+  for (char *tok = strtok(args, " \t"); tok; tok = strtok(NULL, " \t")) {
+    char *value = NULL;
+    if (strcmp(tok, "depth") == 0 || strcmp(tok, "movetime") == 0)
+      value = strtok(NULL, " \t");
+    if (strcmp(tok, "depth") == 0 && value)
+      limits.depth = atoi(value);
+    else if (strcmp(tok, "movetime") == 0 && value)
+      limits.moveTimeMs = atoi(value);
+    else if (strcmp(tok, "infinite") == 0)
+      infinite = 1;
+  }
+  if (!limits.depth && !limits.moveTimeMs && !infinite)
+    limits.depth = opts.searchDepth;
+
+  engine.limits = limits;
+  atomic_store(&pool->stop, 0);
+  pthread_create(&engine.searcher, NULL, engineSearch, NULL);
+  engine.searching = 1;
+}
+
+// setoption name <Threads|Hash|Radius|Symmetry|MCTS> value <n>
+void engineSetOption(char *args) {
+  char name[32];
+  int value;
+  if (sscanf(args, " name %31s value %d", name, &value) != 2) {
+    printf("info string usage: setoption name <name> value <n>\n");
+    return;
+  }
+  if (strcasecmp(name, "Threads") == 0 && value >= 1 && value <= MAX_THREADS) {
+    opts.threads = value;
+    threadPool_destroy();
+    threadPool_init(value);
+  } else if (strcasecmp(name, "Hash") == 0 && value >= 1 && value <= 65536) {
+    opts.hashMb = value;
+    tt_init(value);
+  } else if (strcasecmp(name, "Radius") == 0 && value >= 1 && value <= 2) {
+    opts.radius = value;
+    initBitboards();
+  } else if (strcasecmp(name, "Symmetry") == 0) {
+    opts.symmetry = value != 0;
+    tt_init(opts.hashMb); // Keys are computed differently now
+  } else if (strcasecmp(name, "MCTS") == 0) {
+    opts.mcts = value != 0;
+  } else {
+    printf("info string unknown option or value: %s %d\n", name, value);
+  }
+}
+
+void engineLoop(void) {
+  char line[4096];
+
+  initBitboards();
+  tt_init(opts.hashMb);
+  threadPool_init(configuredThreads());
+  memset(&engine, 0, sizeof(engine));
+
+  while (fgets(line, sizeof(line), stdin)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    char *args = line + strcspn(line, " \t");
+    if (*args)
+      *args++ = '\0';
+
+    if (strcmp(line, "uci") == 0 || strcmp(line, "hello") == 0) {
+      printf("id name zerogc4\n"
+             "option name Threads type spin default %d min 1 max %d\n"
+             "option name Hash type spin default %d min 1 max 65536\n"
+             "option name Radius type spin default %d min 1 max 2\n"
+             "option name Symmetry type check default %s\n"
+             "option name MCTS type check default %s\n"
+             "uciok\n",
+             pool->threadCount, MAX_THREADS, opts.hashMb, opts.radius,
+             opts.symmetry ? "true" : "false", opts.mcts ? "true" : "false");
+    } else if (strcmp(line, "isready") == 0) {
+      printf("readyok\n");
+    } else if (strcmp(line, "newgame") == 0 ||
+               strcmp(line, "ucinewgame") == 0) {
+      engineWait(1);
+      tt_init(opts.hashMb);
+      for (int i = 0; i < pool->threadCount; i++)
+        memset(pool->workers[i].history, 0, sizeof(pool->workers[i].history));
+      memset(&engine.board, 0, sizeof(engine.board));
+      engine.side = 0;
+    } else if (strcmp(line, "position") == 0) {
+      engineWait(0);
+      enginePosition(args);
+    } else if (strcmp(line, "go") == 0) {
+      engineWait(0);
+      engineGo(args);
+    } else if (strcmp(line, "stop") == 0) {
+      engineWait(1);
+    } else if (strcmp(line, "setoption") == 0) {
+      engineWait(0);
+      engineSetOption(args);
+    } else if (strcmp(line, "quit") == 0) {
+      break;
+    } else if (*line) {
+      printf("info string unknown command %s\n", line);
+    }
+    fflush(stdout);
+  }
+
+  engineWait(1);
+  threadPool_destroy();
+  free(tt.buckets);
+}
+
+// Benchmark positions, as engine protocol move lists
+static const struct {
+  const char *name;
+  const char *moves;
+} benchPositions[] = {
+    {"opening", "e5"},
+    {"opening-edge", "i5"},
+    {"early", "b3 c4 d4"},
+    {"middlegame", "b9 c8 c9 d9 b7"},
+    {"middlegame-2", "b8 c7 d8 c8 c9 e7"},
+    {"late", "b8 c7 d8 c8 c9 e7 d10"},
+    {"defense", "e5 a1 f5"},
+    // A three on the diagonal that the side to move has to block; nobody
+    // has a forced win, so the threat search leaves it to the full search
+    {"tactical", "e4 f7 d3 f5 c2"},
+    // Three quarters full, with no line of three for either side yet
+    {"crowded", "b1 c1 e1 d1 f1 h1 i1 a2 j1 e2 c2 f2 d2 i2 h2 j2 a3 d3 e3 "
+                "g3 f3 h3 i3 a4 j3 b4 c4 e4 g4 f4 h4 i4 a5 j4 e5 c5 i5 g5 "
+                "j5 h5 c6 b6 d6 e6 g6 j6 a7 c7 b7 d7 f7 g7 i7 h7 j7 a8 c8 "
+                "e8 d8 f8 a9 i8 b9 c9 e9 d9 i9 h9 j9 b10 c10 f10 d10 i10 "
+                "g10 j10"},
+};
+
+// Search every benchmark position to a fixed depth, each from a fresh hash
+// table and thread pool, and print per-position and total results. The
+// total node count is a signature of the search: any change to it means
+// the search behaves differently. Single-threaded unless --threads is given
+// (only then are node counts reproducible run to run).
+void benchmark(int depth, int json) {
+  int count = sizeof(benchPositions) / sizeof(benchPositions[0]);
+  int threads = opts.threads > 0 ? opts.threads : 1;
+  SearchLimits limits = {depth, 0, NULL, 0};
+  uint64_t totalNodes = 0;
+  long long totalMs = 0;
+  int searched = 0;
+
+  initBitboards();
+  if (json)
+    printf("{\"depth\": %d, \"threads\": %d, \"positions\": [", depth,
+           threads);
+  else
+    printf("%-14s %8s %6s %12s %10s %12s\n", "position", "move", "score",
+           "nodes", "time ms", "nps");
+
+  for (int i = 0; i < count; i++) {
+    Board board;
+    int side = 0;
+    char moves[1024];
+    memset(&board, 0, sizeof(board));
+    snprintf(moves, sizeof(moves), "%s", benchPositions[i].moves);
+    int valid = 1;
+    for (char *tok = strtok(moves, " "); tok; tok = strtok(NULL, " ")) {
+      int cell = parseCell(tok);
+      if (cell < 0 || !bbTest(boardEmpty(&board), cell)) {
+        valid = 0;
+        break;
       }
+      makeMove(&board, cell, side);
+      side = 1 - side;
+    }
+    // The positions are laid out for 10x10; smaller variants skip some
+    if (!valid)
+      continue;
+
+    tt_init(opts.hashMb);
+    threadPool_init(threads);
+    atomic_store(&pool->stop, 0);
+    SearchResult result = searchPosition(&board, side, &limits);
+    threadPool_destroy();
+
+    char move[16] = "none";
+    if (result.cell != NO_MOVE)
+      formatCell(result.cell, move, sizeof(move));
+    long long ms = result.timeMs > 0 ? result.timeMs : 1;
+    unsigned long long nps = result.nodes * 1000 / ms;
+    totalNodes += result.nodes;
+    totalMs += result.timeMs;
+
+    if (json)
+      printf("%s\n  {\"name\": \"%s\", \"bestmove\": \"%s\", \"score\": %d, "
+             "\"depth\": %d, \"nodes\": %llu, \"timeMs\": %lld, \"nps\": %llu}",
+             searched++ ? "," : "", benchPositions[i].name, move, result.score,
+             result.depth, (unsigned long long)result.nodes, result.timeMs,
+             nps);
+    else
+      printf("%-14s %8s %6d %12llu %10lld %12llu\n", benchPositions[i].name,
+             move, result.score, (unsigned long long)result.nodes,
+             result.timeMs, nps);
+    fflush(stdout);
+  }
+
+  unsigned long long nps = totalNodes * 1000 / (totalMs > 0 ? totalMs : 1);
+  if (json)
+    printf("\n], \"nodes\": %llu, \"timeMs\": %lld, \"nps\": %llu}\n",
+           (unsigned long long)totalNodes, totalMs, nps);
+  else
+    printf("\nDepth %d, %d thread%s: %llu nodes (signature), %lld ms, "
+           "%llu nps\n",
+           depth, threads, threads == 1 ? "" : "s",
+           (unsigned long long)totalNodes, totalMs, nps);
+  free(tt.buckets);
+  tt.buckets = NULL;
+}
+
+// Positions of an opening book being built, in the order they were searched
+typedef struct BookBuild {
+  BookEntry *entries;
+  uint64_t count, capacity;
+  int plies;
+  SearchLimits limits;
+  long long start;
+} BookBuild;
+
+int compareBookEntries(const void *a, const void *b) {
+  uint64_t ka = ((const BookEntry *)a)->key;
+  uint64_t kb = ((const BookEntry *)b)->key;
+  return ka < kb ? -1 : ka > kb;
+}
+
+// The engine's move in board, searched unless a mirror image of the position
+// has been already
+int bookMove(BookBuild *build, const Board *board, int side) {
+  int sym;
+  uint64_t key = canonicalKey(board, &sym);
+  for (uint64_t i = 0; i < build->count; i++)
+    if (build->entries[i].key == key)
+      return symCellInv[sym][build->entries[i].move];
+
+  atomic_store(&pool->stop, 0);
+  SearchResult result = searchPosition(board, side, &build->limits);
+  if (result.cell == NO_MOVE)
+    return NO_MOVE;
+  if (build->count == build->capacity) {
+    build->capacity = build->capacity ? 2 * build->capacity : 256;
+    build->entries =
+        realloc(build->entries, build->capacity * sizeof(BookEntry));
+  }
+  BookEntry entry = {key, (uint16_t)symCell[sym][result.cell],
+                     (int16_t)result.score, (uint8_t)result.depth, {0}};
+  build->entries[build->count++] = entry;
+
+  char move[16];
+  formatCell(result.cell, move, sizeof(move));
+  printf("%6llu  %-4s score %6d depth %2d  %7lld ms  (%lld s total)\n",
+         (unsigned long long)build->count, move, result.score, result.depth,
+         result.timeMs, (nowMs() - build->start) / 1000);
+  fflush(stdout);
+  return result.cell;
+}
+
+// Walk the plies left from board: one move of the engine's, the book move,
+// and BOOK_WIDTH replies of the opponent's: its own book move (the likeliest
+// reply of a strong opponent, and an entry for the book of the other side)
+// and those the heuristic likes best, skipping mirror images of replies
+// already followed
+void bookExpand(BookBuild *build, Board *board, int side, int ply,
+                int engineSide) {
+  Bitboard empty = boardEmpty(board);
+  if (ply >= build->plies || !bbAny(empty) || hasLine(board->stones[0]) ||
+      hasLine(board->stones[1]))
+    return;
+
+  if (side == engineSide) {
+    int cell = bookMove(build, board, side);
+    if (cell == NO_MOVE)
+      return;
+    makeMove(board, cell, side);
+    bookExpand(build, board, 1 - side, ply + 1, engineSide);
+    unmakeMove(board, cell, side);
+    return;
+  }
+
+  ScoredMove replies[MAX_MOVES];
+  int count = 0;
+  int best = bookMove(build, board, side);
+  Bitboard pending = candidateMoves(candidateCells(board), empty);
+  while (bbAny(pending)) {
+    int cell = bbPopLsb(&pending);
+    replies[count].cell = cell;
+    replies[count].score =
+        cell == best ? INF_SCORE : childScore(board, side, cell);
+    count++;
+  }
+  qsort(replies, count, sizeof(ScoredMove), compareScoredMovesMax);
+
+  uint64_t followed[BOOK_WIDTH];
+  int width = 0;
+  for (int i = 0; i < count && width < BOOK_WIDTH; i++) {
+    int sym, seen = 0;
+    makeMove(board, replies[i].cell, side);
+    uint64_t key = canonicalKey(board, &sym);
+    for (int j = 0; j < width; j++)
+      seen |= followed[j] == key;
+    if (!seen) {
+      followed[width++] = key;
+      bookExpand(build, board, 1 - side, ply + 1, engineSide);
     }
+    unmakeMove(board, replies[i].cell, side);
+  }
+}
+
+// Build the opening book for both sides the engine can play and write it to
+// path, sorted by key. Returns non-zero on failure.
+int buildBook(const char *path, int depth) {
+  BookBuild build = {NULL, 0, 0, BOOK_PLIES, {depth, 0, NULL, 0}, nowMs()};
+  initBitboards();
+  tt_init(opts.hashMb);
+  threadPool_init(configuredThreads());
+  printf("Opening book for %s: %d plies, %d replies per opponent turn, "
+         "depth %d, %d threads\n",
+         VARIANT_NAME, BOOK_PLIES, BOOK_WIDTH, depth, pool->threadCount);
+
+  for (int engineSide = 0; engineSide < 2; engineSide++) {
+    Board board;
+    memset(&board, 0, sizeof(board));
+    bookExpand(&build, &board, 0, 0, engineSide);
   }
+  threadPool_destroy();
+
+  qsort(build.entries, build.count, sizeof(BookEntry), compareBookEntries);
+  BookHeader header;
+  bookHeaderInit(&header, build.count);
+  FILE *f = fopen(path, "wb");
+  int failed = !f || fwrite(&header, sizeof(header), 1, f) != 1 ||
+               fwrite(build.entries, sizeof(BookEntry), build.count, f) !=
+                   build.count;
+  if (f && fclose(f) != 0)
+    failed = 1;
+  if (failed)
+    perror(path);
+  else
+    printf("Wrote %llu positions to %s in %lld s\n",
+           (unsigned long long)build.count, path,
+           (nowMs() - build.start) / 1000);
+  free(build.entries);
+  return failed;
+}
 
-  // Calculate adaptive search depth based on move number
-  int adaptiveDepth = getAdaptiveDepth(game->moveNo);
-  llog("Using adaptive depth: %d (moveNo: %d)\n", adaptiveDepth, game->moveNo);
+// Cross-check the incremental evaluation and the bitboard line tests
+// against the reference scans over random games, with every kernel set the
+// CPU supports: the board score and the score of every child against
+// assignScoreToGrid(), hasLine() against findWinningSequence(),
+// winningCells() against trying each empty cell, and make/unmake of a whole
+// game back to the empty board. Returns the number of mismatches.
+int selfTest(int games) {
+  int kernels = 1;
+  long long positions = 0, checks = 0, mismatches = 0;
+  uint64_t rng = 0x5E1F7E57ULL;
+  Board empty;
 
-  // First pass: check for immediate winning moves
-  for (int i = 0; i < N; i++) {
-    for (int j = 0; j < M; j++) {
-      if (game->grid[i][j] == 0) {
-        int newGrid[N][M];
-        memcpy(newGrid, game->grid, N * M * sizeof(int));
-        newGrid[i][j] = 2;
-
-        int score = assignScoreToGrid(newGrid);
-        if (score == 1000) {
-          llog("AI found winning move at [%d][%d]\n", i, j);
-          p.x = i;
-          p.y = j;
-          return p;
+  initBitboards();
+#ifdef HAVE_AVX2
+  if (useAvx2)
+    kernels = 2;
+#endif
+  memset(&empty, 0, sizeof(empty));
+
+  for (int kernel = 0; kernel < kernels; kernel++) {
+    useAvx2 = kernel;
+    for (int g = 0; g < games; g++) {
+      Board board = empty;
+      int grid[N][M] = {{0}};
+      int winMark[N][M];
+      int moves[N * M];
+      int count = 0;
+
+      while (1) {
+        positions++;
+        int winner = findWinningSequence(grid, winMark);
+        Bitboard open = boardEmpty(&board);
+        for (int p = 0; p < 2; p++) {
+          checks++;
+          mismatches += hasLine(board.stones[p]) != (winner == p + 1);
+        }
+        if (winner || !bbAny(open))
+          break;
+
+        checks++;
+        mismatches += board.score != assignScoreToGrid(&board);
+        for (int p = 0; p < 2; p++) {
+          Bitboard wins = BB_NONE;
+          for (Bitboard pending = open; bbAny(pending);) {
+            int cell = bbPopLsb(&pending);
+            int predicted = childScore(&board, p, cell);
+            makeMove(&board, cell, p);
+            if (hasLine(board.stones[p])) {
+              wins = bbOr(wins, bbBit(cell));
+            } else {
+              int score = assignScoreToGrid(&board);
+              checks++;
+              mismatches += predicted != (p ? score : -score);
+            }
+            unmakeMove(&board, cell, p);
+          }
+          Bitboard cells = winningCells(board.stones[p], open);
+          checks++;
+          mismatches += bbAny(bbAndNot(wins, cells)) ||
+                        bbAny(bbAndNot(cells, wins));
         }
-      }
-    }
-  }
 
-  // Second pass: parallel evaluation of all moves
-  MoveTask *tasks[MAX_MOVES];
-  int taskCount = 0;
+        // Random move, mostly near the stones so that lines get built
+        Bitboard near = candidateMoves(candidateCells(&board), open);
+        int choices = 0;
+        for (Bitboard pending = near; bbAny(pending); bbPopLsb(&pending))
+          choices++;
+        int pick = (int)(nextRandom(&rng) % choices);
+        while (pick--)
+          bbPopLsb(&near);
+        int cell = bbLsb(near);
+        makeMove(&board, cell, count % 2);
+        grid[cell / CELL_STRIDE][cell % CELL_STRIDE] = count % 2 + 1;
+        moves[count++] = cell;
+      }
 
-  // Create tasks for each legal move
-  for (int i = 0; i < N; i++) {
-    for (int j = 0; j < M; j++) {
-      if (game->grid[i][j] == 0) {
-        tasks[taskCount] = malloc(sizeof(MoveTask));
-        memcpy(tasks[taskCount]->grid, game->grid, N * M * sizeof(int));
-        tasks[taskCount]->grid[i][j] = 2;
-        tasks[taskCount]->move.x = i;
-        tasks[taskCount]->move.y = j;
-        tasks[taskCount]->score = -10000;
-        tasks[taskCount]->completed = 0;
-        taskCount++;
+      while (count > 0) {
+        count--;
+        unmakeMove(&board, moves[count], count % 2);
       }
+      checks++;
+      mismatches += memcmp(&board, &empty, sizeof(Board)) != 0;
     }
   }
 
-  // Sort tasks by heuristic score (move ordering for better pruning)
-  qsort(tasks, taskCount, sizeof(MoveTask *), compareMoves);
+  printf("Self-test %s: %d games x %d kernel set%s, %lld positions, %lld "
+         "checks, %lld mismatches\n",
+         VARIANT_NAME, games, kernels, kernels == 1 ? "" : "s", positions,
+         checks, mismatches);
+  return (int)(mismatches > 0);
+}
 
-  // Submit tasks to thread pool
-  pthread_mutex_lock(&pool->mutex);
-  pool->task_count = taskCount;
-  pool->next_task = 0;
-  for (int i = 0; i < taskCount; i++) {
-    pool->tasks[i] = tasks[i];
-  }
-  pthread_cond_broadcast(&pool->work_available);
-  pthread_mutex_unlock(&pool->mutex);
+// Self-play match: two engine configurations play each other, every
+// opening twice with colours swapped. Each configuration runs as its own
+// --engine process (the pool, table and options are per process), so games
+// on different threads never share search state. Moves are checked and
+// games decided here with checkWin(); no terminal is involved.
+typedef struct MatchConfig {
+  const char *spec; // As given, e.g. "depth=6,threads=1"
+  int depth, moveTimeMs, threads, hashMb, radius, symmetry, mcts;
+} MatchConfig;
 
-  // Wait for all tasks to complete
-  threadPool_wait();
+typedef struct EngineProcess {
+  pid_t pid;
+  FILE *in;  // Commands to the engine
+  FILE *out; // Its replies
+} EngineProcess;
 
-  // Find best move from results
-  for (int i = 0; i < taskCount; i++) {
-    llog("Move [%d][%d] score: %d\n", tasks[i]->move.x, tasks[i]->move.y,
-         tasks[i]->score);
-    if (tasks[i]->score > bestScore) {
-      bestScore = tasks[i]->score;
-      p = tasks[i]->move;
-    }
+typedef struct Match {
+  MatchConfig configs[2];
+  const char *self; // Path of this executable, to start engines
+  int games;
+  int (*openings)[MATCH_OPENING_PLIES]; // Cells of each pair's opening
+  double elo0, elo1; // SPRT hypotheses for configs[0] against configs[1]
+
+  pthread_mutex_t lock; // Guards the fields below
+  int nextGame;
+  int played;
+  int wins, draws, losses; // From configs[0]'s point of view
+  int decided;             // SPRT reached a verdict: start no more games
+} Match;
+
+// Parse "key=value,..." with keys depth, movetime, threads, hash, radius,
+// symmetry and mcts. Returns 0 on an unknown key.
+int parseMatchConfig(const char *spec, MatchConfig *config) {
+  MatchConfig defaults = {spec, DEFAULT_DEPTH, 0, 1, DEFAULT_HASH_MB,
+                          DEFAULT_RADIUS, 0, 0};
+  char buf[256];
+  *config = defaults;
+  snprintf(buf, sizeof(buf), "%s", spec);
+  for (char *tok = strtok(buf, ","); tok; tok = strtok(NULL, ",")) {
+    char key[32];
+    int value;
+    if (sscanf(tok, " %31[^=]=%d", key, &value) != 2)
+      return 0;
+    if (strcmp(key, "depth") == 0)
+      config->depth = value;
+    else if (strcmp(key, "movetime") == 0)
+      config->moveTimeMs = value;
+    else if (strcmp(key, "threads") == 0)
+      config->threads = value;
+    else if (strcmp(key, "hash") == 0)
+      config->hashMb = value;
+    else if (strcmp(key, "radius") == 0)
+      config->radius = value;
+    else if (strcmp(key, "symmetry") == 0)
+      config->symmetry = value;
+    else if (strcmp(key, "mcts") == 0)
+      config->mcts = value;
+    else
+      return 0;
   }
+  return 1;
+}
 
-  // Clean up tasks
-  for (int i = 0; i < taskCount; i++) {
-    free(tasks[i]);
+int engineProcessStart(EngineProcess *e, const char *self,
+                       const MatchConfig *config) {
+  int toEngine[2], fromEngine[2];
+  if (pipe2(toEngine, O_CLOEXEC) < 0)
+    return 0;
+  if (pipe2(fromEngine, O_CLOEXEC) < 0) {
+    close(toEngine[0]);
+    close(toEngine[1]);
+    return 0;
   }
 
-  // Reset pool for next use
-  pthread_mutex_lock(&pool->mutex);
-  pool->task_count = 0;
-  pool->next_task = 0;
-  pthread_mutex_unlock(&pool->mutex);
+  char threads[16], hash[16], radius[16];
+  snprintf(threads, sizeof(threads), "%d", config->threads);
+  snprintf(hash, sizeof(hash), "%d", config->hashMb);
+  snprintf(radius, sizeof(radius), "%d", config->radius);
+  char *argv[16] = {(char *)self, "--engine", "--variant", VARIANT_NAME,
+                    "--threads", threads, "--hash", hash, "--radius", radius};
+  int argc = 10;
+  if (config->symmetry)
+    argv[argc++] = "--symmetry";
+  if (config->mcts)
+    argv[argc++] = "--mcts";
 
-  llog("AI chose [%d][%d] with score %d\n", p.x, p.y, bestScore);
-  return p;
+  e->pid = fork();
+  if (e->pid == 0) {
+    dup2(toEngine[0], STDIN_FILENO);
+    dup2(fromEngine[1], STDOUT_FILENO);
+    execv(self, argv);
+    _exit(127);
+  }
+  close(toEngine[0]);
+  close(fromEngine[1]);
+  if (e->pid < 0) {
+    close(toEngine[1]);
+    close(fromEngine[0]);
+    return 0;
+  }
+  e->in = fdopen(toEngine[1], "w");
+  e->out = fdopen(fromEngine[0], "r");
+  return 1;
 }
 
-// Find and mark winning positions in the grid
-// Returns winning player (1 or 2), or 0 if no win
-// Marks winning cells in winMark array
-int findWinningSequence(int grid[N][M], int winMark[N][M]) {
-  memset(winMark, 0, N * M * sizeof(int));
-
-  // Check all positions for 4-in-a-row
-  for (int i = 0; i < N; i++) {
-    for (int j = 0; j < M; j++) {
-      if (grid[i][j] == 0)
-        continue;
+void engineProcessStop(EngineProcess *e) {
+  fprintf(e->in, "quit\n");
+  fclose(e->in);
+  fclose(e->out);
+  waitpid(e->pid, NULL, 0);
+}
 
-      int player = grid[i][j];
+// Ask the engine for its move in the position reached by moves. Returns
+// the cell, or -1 if the engine gave none or went away. If info is given,
+// it gets the last "info depth" line of the search.
+int engineProcessMove(EngineProcess *e, const MatchConfig *config,
+                      const char *moves, char *info, size_t infoSize) {
+  char line[1024];
+  fprintf(e->in, "position moves %s\n", moves);
+  if (config->moveTimeMs)
+    fprintf(e->in, "go movetime %d\n", config->moveTimeMs);
+  else
+    fprintf(e->in, "go depth %d\n", config->depth);
+  fflush(e->in);
 
-      // Check horizontal (right)
-      if (j + 3 < M) {
-        int match = 1;
-        for (int k = 1; k <= 3; k++) {
-          if (grid[i][j + k] != player) {
-            match = 0;
-            break;
-          }
-        }
-        if (match) {
-          for (int k = 0; k <= 3; k++) {
-            winMark[i][j + k] = 1;
-          }
-          return player;
-        }
-      }
+  if (info)
+    info[0] = '\0';
+  while (fgets(line, sizeof(line), e->out)) {
+    if (info && strncmp(line, "info depth ", 11) == 0)
+      snprintf(info, infoSize, "%s", line);
+    if (strncmp(line, "bestmove ", 9) == 0) {
+      line[strcspn(line, "\r\n")] = '\0';
+      return parseCell(line + 9);
+    }
+  }
+  return -1;
+}
 
-      // Check vertical (down)
-      if (i + 3 < N) {
-        int match = 1;
-        for (int k = 1; k <= 3; k++) {
-          if (grid[i + k][j] != player) {
-            match = 0;
-            break;
-          }
-        }
-        if (match) {
-          for (int k = 0; k <= 3; k++) {
-            winMark[i + k][j] = 1;
-          }
-          return player;
-        }
-      }
+// Random openings in the middle of the board, one per pair of games, with
+// no line of three for either side. No two are the same position or mirror
+// images of each other: deterministic engines would replay the same pair,
+// and the statistics would count those games twice.
+void matchOpenings(Match *match) {
+  int pairs = (match->games + 1) / 2;
+  uint64_t *keys = calloc(pairs, sizeof(uint64_t));
+  uint64_t rng = 0x9E3779B97F4A7C15ULL;
+  match->openings = calloc(pairs, sizeof(match->openings[0]));
 
-      // Check diagonal down-right
-      if (i + 3 < N && j + 3 < M) {
-        int match = 1;
-        for (int k = 1; k <= 3; k++) {
-          if (grid[i + k][j + k] != player) {
-            match = 0;
-            break;
-          }
-        }
-        if (match) {
-          for (int k = 0; k <= 3; k++) {
-            winMark[i + k][j + k] = 1;
-          }
-          return player;
-        }
+  for (int id = 0; id < pairs; id++) {
+    for (int attempt = 0;; attempt++) {
+      Board board;
+      memset(&board, 0, sizeof(board));
+      for (int ply = 0; ply < MATCH_OPENING_PLIES; ply++) {
+        int cell;
+        do {
+          int x = N / 2 - MATCH_OPENING_AREA / 2 +
+                  (int)(nextRandom(&rng) % MATCH_OPENING_AREA);
+          int y = M / 2 - MATCH_OPENING_AREA / 2 +
+                  (int)(nextRandom(&rng) % MATCH_OPENING_AREA);
+          cell = CELL(x, y);
+        } while (!bbTest(boardEmpty(&board), cell));
+        makeMove(&board, cell, ply % 2);
+        match->openings[id][ply] = cell;
       }
+      Bitboard empty = boardEmpty(&board);
+      if (bbAny(winningCells(board.stones[0], empty)) ||
+          bbAny(winningCells(board.stones[1], empty)))
+        continue;
 
-      // Check diagonal down-left
-      if (i + 3 < N && j - 3 >= 0) {
-        int match = 1;
-        for (int k = 1; k <= 3; k++) {
-          if (grid[i + k][j - k] != player) {
-            match = 0;
-            break;
-          }
-        }
-        if (match) {
-          for (int k = 0; k <= 3; k++) {
-            winMark[i + k][j - k] = 1;
-          }
-          return player;
-        }
+      int sym, seen = 0;
+      uint64_t key = canonicalKey(&board, &sym);
+      for (int i = 0; i < id && !seen; i++)
+        seen = keys[i] == key;
+      // A repeat is better than no game, should the openings run out
+      if (!seen || attempt >= MATCH_OPENING_TRIES) {
+        keys[id] = key;
+        break;
       }
     }
   }
+  free(keys);
+}
+
+// Play one game; configs[first] moves first. Returns 1, 0 or -1: a win,
+// draw or loss for configs[0].
+int playMatchGame(Match *match, EngineProcess engines[2], int opening,
+                  int first) {
+  int grid[N][M];
+  char moves[4 * N * M] = "";
+  memset(grid, 0, sizeof(grid));
+  for (int ply = 0; ply < MATCH_OPENING_PLIES; ply++) {
+    int cell = match->openings[opening][ply];
+    grid[cell / CELL_STRIDE][cell % CELL_STRIDE] = ply % 2 + 1;
+    size_t len = strlen(moves);
+    formatCell(cell, moves + len + (len ? 1 : 0), sizeof(moves) - len - 1);
+    if (len)
+      moves[len] = ' ';
+  }
+
+  for (int i = 0; i < 2; i++) {
+    fprintf(engines[i].in, "newgame\n");
+    fflush(engines[i].in);
+  }
 
+  for (int ply = MATCH_OPENING_PLIES; ply < N * M; ply++) {
+    int side = ply % 2;
+    int config = side == 0 ? first : 1 - first;
+    int cell = engineProcessMove(&engines[config], &match->configs[config],
+                                 moves, NULL, 0);
+    int x = cell / CELL_STRIDE, y = cell % CELL_STRIDE;
+    // An engine that gives no legal move loses
+    if (cell < 0 || grid[x][y])
+      return config == 0 ? -1 : 1;
+
+    grid[x][y] = side + 1;
+    size_t len = strlen(moves);
+    formatCell(cell, moves + len + (len ? 1 : 0), sizeof(moves) - len - 1);
+    if (len)
+      moves[len] = ' ';
+
+    if (checkWin(grid))
+      return config == 0 ? 1 : -1;
+  }
   return 0;
 }
 
-int checkWin(int grid[N][M]) {
-  int score = assignScoreToGrid(grid);
-  if (score == -1000)
-    return 1;
-  if (score == 1000)
-    return 2;
-  return 0;
+// Elo difference for an expected score
+double eloFromScore(double score) {
+  if (score <= 0)
+    return -INFINITY;
+  if (score >= 1)
+    return INFINITY;
+  return -400.0 * log10(1.0 / score - 1.0);
 }
 
-void setup(void) {
-  struct termios raw;
+double scoreFromElo(double elo) { return 1.0 / (1.0 + pow(10, -elo / 400)); }
+
+// Elo estimate with 95% error bar and the SPRT log-likelihood ratio of
+// elo1 against elo0 (normal approximation of the trinomial results)
+void matchEstimate(const Match *match, double *elo, double *error,
+                   double *llr) {
+  int n = match->wins + match->draws + match->losses;
+  *elo = *error = *llr = 0;
+  if (n == 0)
+    return;
 
-#ifdef LOG_ENABLED
-  logfile = fopen("/tmp/zeroglog", "w");
-  if (!logfile) {
-    perror("open logfile");
+  double score = (match->wins + 0.5 * match->draws) / n;
+  double variance = (match->wins * pow(1 - score, 2) +
+                     match->draws * pow(0.5 - score, 2) +
+                     match->losses * pow(score, 2)) /
+                    n;
+  double margin = 1.96 * sqrt(variance / n);
+  *elo = eloFromScore(score);
+  // A clean sweep has no spread, and no finite error either
+  if (score - margin <= 0 || score + margin >= 1)
+    *error = INFINITY;
+  else
+    *error = (eloFromScore(score + margin) - eloFromScore(score - margin)) / 2;
+
+  // A clean sweep has no spread at all, which would hold the LLR at 0 just
+  // when the result is clearest: the test counts half a draw on top
+  double games = n + 0.5, draws = match->draws + 0.5;
+  double s = (match->wins + 0.5 * draws) / games;
+  double v = (match->wins * pow(1 - s, 2) + draws * pow(0.5 - s, 2) +
+              match->losses * pow(s, 2)) /
+             games;
+  if (v > 0) {
+    double s0 = scoreFromElo(match->elo0), s1 = scoreFromElo(match->elo1);
+    *llr = games * (s1 - s0) * (2 * s - s0 - s1) / (2 * v);
   }
-#endif
+}
 
-  signal(SIGINT, signal_hander);
-  signal(SIGKILL, signal_hander);
-  signal(SIGTERM, signal_hander);
+void *matchWorker(void *arg) {
+  Match *match = arg;
+  EngineProcess engines[2];
 
-  tcgetattr(STDIN_FILENO, &origterm);
-  raw = origterm;
+  for (int i = 0; i < 2; i++) {
+    if (!engineProcessStart(&engines[i], match->self, &match->configs[i])) {
+      perror("start engine");
+      exit(1);
+    }
+  }
 
-  raw.c_lflag &= ~(ICANON | ECHO); // Disable canonical and echo mode
-  raw.c_cc[VMIN] = 0;              // Not blocking
-  raw.c_cc[VTIME] = 0;             // No timeout
+  // SPRT bounds for alpha = beta = 0.05
+  double lower = log(0.05 / 0.95), upper = log(0.95 / 0.05);
+  while (1) {
+    pthread_mutex_lock(&match->lock);
+    int game = match->nextGame++;
+    int done = game >= match->games || match->decided;
+    pthread_mutex_unlock(&match->lock);
+    if (done)
+      break;
 
-  // Apply changes
-  tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+    int result = playMatchGame(match, engines, game / 2, game % 2);
 
-  atexit(teardown);
+    pthread_mutex_lock(&match->lock);
+    match->played++;
+    match->wins += result > 0;
+    match->draws += result == 0;
+    match->losses += result < 0;
+    double elo, error, llr;
+    matchEstimate(match, &elo, &error, &llr);
+    if (llr <= lower || llr >= upper)
+      match->decided = 1;
+    printf("Game %4d: %+d  W-D-L %d-%d-%d  Elo %+.1f +/- %.1f  "
+           "LLR %.2f [%.2f, %.2f]\n",
+           match->played, result, match->wins, match->draws, match->losses,
+           elo, error, llr, lower, upper);
+    fflush(stdout);
+    pthread_mutex_unlock(&match->lock);
+  }
 
-  printf("%s%s%s", HIDE_CURSOR, CLEAR_SCREEN, REPOS_CURSOR);
-  fflush(stdout);
+  for (int i = 0; i < 2; i++)
+    engineProcessStop(&engines[i]);
+  return NULL;
+}
 
-  game = malloc(sizeof(Game));
-  memset(game->grid, 0, M * N * sizeof(int));
-  memset(game->input, 0, INPUT_BUF_LEN);
-  game->failedInput = 0;
-  game->won = 0;
-  game->moveNo = 0;
-  game->aiThinking = 0;
-  game->aiMove.x = -1;
-  game->aiMove.y = -1;
-  game->searchDepth = DEFAULT_DEPTH;
+int runMatch(const char *self, const char *specA, const char *specB,
+             int games, int concurrency, double elo0, double elo1) {
+  Match match;
+  memset(&match, 0, sizeof(match));
+  if (!parseMatchConfig(specA, &match.configs[0]) ||
+      !parseMatchConfig(specB, &match.configs[1])) {
+    fprintf(stderr, "Invalid engine configuration. Keys: depth, movetime, "
+                    "threads, hash, radius, symmetry, mcts\n");
+    return 1;
+  }
+  match.self = self;
+  match.games = games;
+  match.elo0 = elo0;
+  match.elo1 = elo1;
+  pthread_mutex_init(&match.lock, NULL);
+  initBitboards();
+  matchOpenings(&match);
+  signal(SIGPIPE, SIG_IGN); // A dead engine shows up as a missing move
+
+  // Games run side by side as long as their engines fit on the CPUs
+  if (concurrency <= 0) {
+    int threads = match.configs[0].threads > match.configs[1].threads
+                      ? match.configs[0].threads
+                      : match.configs[1].threads;
+    concurrency = onlineCpus() / (threads > 0 ? threads : 1);
+    if (concurrency < 1)
+      concurrency = 1;
+  }
+
+  printf("Match: \"%s\" vs \"%s\", %d games, %d at a time, SPRT [%.1f, "
+         "%.1f]\n",
+         specA, specB, games, concurrency, elo0, elo1);
+  pthread_t *workers = calloc(concurrency, sizeof(pthread_t));
+  for (int i = 0; i < concurrency; i++)
+    pthread_create(&workers[i], NULL, matchWorker, &match);
+  for (int i = 0; i < concurrency; i++)
+    pthread_join(workers[i], NULL);
+  free(workers);
 
-  // Initialize thread pool
-  threadPool_init();
+  double elo, error, llr;
+  matchEstimate(&match, &elo, &error, &llr);
+  double lower = log(0.05 / 0.95), upper = log(0.95 / 0.05);
+  printf("\nResult for \"%s\": W-D-L %d-%d-%d in %d games\n"
+         "Elo %+.1f +/- %.1f (95%%)\n"
+         "SPRT: LLR %.2f [%.2f, %.2f]: %s\n",
+         specA, match.wins, match.draws, match.losses, match.played, elo,
+         error, llr, lower, upper,
+         llr >= upper   ? "H1 accepted (at least as strong as elo1)"
+         : llr <= lower ? "H0 accepted (not stronger than elo0)"
+                        : "inconclusive");
+  free(match.openings);
+  pthread_mutex_destroy(&match.lock);
+  return 0;
 }
 
-void update(void) {
-  char c;
-  Pos pos;
-  int moveDone = 0;
+// Batch analysis: positions are read one per line and each is searched by
+// one of several single-threaded engine processes, so that positions run
+// side by side on all cores instead of splitting one search between them.
+// Results are printed in the order of the input.
+typedef struct Analysis {
+  MatchConfig config;
+  const char *self; // Path of this executable, to start engines
+  FILE *input;
 
-  if (read(STDIN_FILENO, &c, 1) == 1) {
-    // Reset vars
-    game->failedInput = 0;
-    game->invalidMove = 0;
-
-    switch (c) {
-    // Backwards to delete last char
-    case 127: {
-      int s = strlen(game->input);
-      if (s > 0) {
-        game->input[s - 1] = '\0';
-      }
-      break;
-    }
-    case '\n': {
-      if (game->won) {
-        setup();
-        return;
-      }
-      pos = parseInput();
-      moveDone = 1;
-      memset(game->input, 0, INPUT_BUF_LEN);
-      break;
-    }
-    default: {
-      int s = strlen(game->input);
-      if (s < INPUT_BUF_LEN - 1) {
-        game->input[s] = c;
-        game->input[s + 1] = '\0';
+  pthread_mutex_t lock; // Guards the fields below
+  int nextPosition;     // Index of the next line read
+  int nextOutput;       // Index of the next result to print
+  char **results;       // Results not printed yet, by index
+  int capacity;
+} Analysis;
+
+// Turn a line of input into moves for the engine's position command. A
+// line is either moves, as "e5 f6 e6", or the grid: N * M of '.', 'x' and
+// 'o', row 1 first, with rows optionally split by '/'. The stones of a
+// grid are replayed alternately, x first. Returns 0 for neither.
+int analysisMoves(const char *line, char *moves, size_t size) {
+  char grid[N * M];
+  int cells = 0, isGrid = 1;
+  for (const char *c = line; *c && isGrid; c++) {
+    char lower = *c >= 'A' && *c <= 'Z' ? *c - 'A' + 'a' : *c;
+    if (lower == '/')
+      continue;
+    if ((lower == '.' || lower == 'x' || lower == 'o') && cells < N * M)
+      grid[cells++] = lower;
+    else
+      isGrid = 0;
+  }
+
+  size_t len = 0;
+  moves[0] = '\0';
+  if (isGrid && cells == N * M) {
+    int stones[2][N * M], count[2] = {0, 0};
+    for (int i = 0; i < N * M; i++) {
+      if (grid[i] != '.') {
+        int side = grid[i] == 'o';
+        stones[side][count[side]++] = CELL(i / M, i % M);
       }
     }
+    if (count[0] != count[1] && count[0] != count[1] + 1)
+      return 0;
+    for (int i = 0; i < count[0] + count[1] && len < size; i++) {
+      char move[16];
+      formatCell(stones[i % 2][i / 2], move, sizeof(move));
+      len += snprintf(moves + len, size - len, "%s%s", len ? " " : "", move);
     }
+    return len < size;
   }
 
-  if (moveDone) {
-    if (!isValidMove(pos.x, pos.y, game->grid)) {
-      game->invalidMove = 1;
-      return;
+  Board board;
+  int side = 0;
+  char buf[1024], *save;
+  memset(&board, 0, sizeof(board));
+  snprintf(buf, sizeof(buf), "%s", line);
+  for (char *tok = strtok_r(buf, " \t", &save); tok && len < size;
+       tok = strtok_r(NULL, " \t", &save)) {
+    if (strcmp(tok, "startpos") == 0 || strcmp(tok, "moves") == 0)
+      continue;
+    int cell = parseCell(tok);
+    if (cell < 0 || !bbTest(boardEmpty(&board), cell))
+      return 0;
+    makeMove(&board, cell, side);
+    side = 1 - side;
+    char move[16];
+    formatCell(cell, move, sizeof(move));
+    len += snprintf(moves + len, size - len, "%s%s", len ? " " : "", move);
+  }
+  return len < size;
+}
+
+// Read the next position, skipping blank lines and # comments
+int analysisLine(FILE *input, char *line, size_t size) {
+  while (fgets(line, size, input)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    size_t start = strspn(line, " \t");
+    if (line[start] && line[start] != '#') {
+      memmove(line, line + start, strlen(line + start) + 1);
+      return 1;
     }
-    game->grid[pos.x][pos.y] = 1;
-    game->moveNo++;
+  }
+  return 0;
+}
 
-    int winningPlayer = checkWin(game->grid);
-    if (winningPlayer) {
-      game->won = winningPlayer;
-      llog("%s won!!!\n", winningPlayer == 1 ? "You" : "AI");
-      return;
+// Hand in the result of position index, then print every result that is
+// next in order
+void analysisOutput(Analysis *analysis, int index, char *result) {
+  pthread_mutex_lock(&analysis->lock);
+  if (index >= analysis->capacity) {
+    int capacity = analysis->capacity ? analysis->capacity * 2 : 64;
+    while (capacity <= index)
+      capacity *= 2;
+    analysis->results =
+        realloc(analysis->results, capacity * sizeof(analysis->results[0]));
+    memset(analysis->results + analysis->capacity, 0,
+           (capacity - analysis->capacity) * sizeof(analysis->results[0]));
+    analysis->capacity = capacity;
+  }
+  analysis->results[index] = result;
+  while (analysis->nextOutput < analysis->capacity &&
+         analysis->results[analysis->nextOutput]) {
+    fputs(analysis->results[analysis->nextOutput], stdout);
+    free(analysis->results[analysis->nextOutput]);
+    analysis->results[analysis->nextOutput++] = NULL;
+  }
+  fflush(stdout);
+  pthread_mutex_unlock(&analysis->lock);
+}
+
+void *analysisWorker(void *arg) {
+  Analysis *analysis = arg;
+  EngineProcess engine;
+  if (!engineProcessStart(&engine, analysis->self, &analysis->config)) {
+    perror("start engine");
+    exit(1);
+  }
+
+  char line[1024], moves[1024], info[1024];
+  while (1) {
+    pthread_mutex_lock(&analysis->lock);
+    int index = analysis->nextPosition;
+    int more = analysisLine(analysis->input, line, sizeof(line));
+    analysis->nextPosition += more;
+    pthread_mutex_unlock(&analysis->lock);
+    if (!more)
+      break;
+
+    char result[2048];
+    if (!analysisMoves(line, moves, sizeof(moves))) {
+      snprintf(result, sizeof(result), "%s\terror\n", line);
+    } else {
+      // A fresh table for every position keeps the results independent of
+      // which engine got it
+      fprintf(engine.in, "newgame\n");
+      int cell = engineProcessMove(&engine, &analysis->config, moves, info,
+                                   sizeof(info));
+      char move[16] = "none", score[32] = "-";
+      int depth = 0;
+      unsigned long long nodes = 0;
+      long long timeMs = 0;
+      if (cell >= 0)
+        formatCell(cell, move, sizeof(move));
+      sscanf(info, "info depth %d score %31s nodes %llu nps %*u time %lld",
+             &depth, score, &nodes, &timeMs);
+      snprintf(result, sizeof(result), "%s\t%s\t%s\t%d\t%llu\t%lld\n", line,
+               move, score, depth, nodes, timeMs);
     }
+    analysisOutput(analysis, index, strdup(result));
+  }
 
-    // Show user's move before AI thinks
-    game->aiThinking = 1;
-    draw();
+  engineProcessStop(&engine);
+  return NULL;
+}
+
+int runAnalysis(const char *self, const char *path, int concurrency) {
+  Analysis analysis;
+  memset(&analysis, 0, sizeof(analysis));
+  analysis.input = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+  if (!analysis.input) {
+    perror("open positions");
+    return 1;
+  }
+  MatchConfig config = {"analysis", opts.searchDepth, opts.moveTimeMs, 1,
+                        opts.hashMb, opts.radius, opts.symmetry, opts.mcts};
+  analysis.config = config;
+  analysis.self = self;
+  pthread_mutex_init(&analysis.lock, NULL);
+  initBitboards();
+  signal(SIGPIPE, SIG_IGN); // A dead engine shows up as a missing move
 
-    // AI computes its move (blocking)
-    Pos aiPos = aiPlay();
-    game->grid[aiPos.x][aiPos.y] = 2;
-    game->aiThinking = 0;
+  // One single-threaded engine per CPU
+  if (concurrency <= 0)
+    concurrency = onlineCpus();
 
-    winningPlayer = checkWin(game->grid);
-    if (winningPlayer) {
-      game->won = winningPlayer;
-      llog("%s won!!!\n", winningPlayer == 1 ? "You" : "AI");
+  long long start = nowMs();
+  pthread_t *workers = calloc(concurrency, sizeof(pthread_t));
+  for (int i = 0; i < concurrency; i++)
+    pthread_create(&workers[i], NULL, analysisWorker, &analysis);
+  for (int i = 0; i < concurrency; i++)
+    pthread_join(workers[i], NULL);
+  free(workers);
+  long long elapsed = nowMs() - start;
+
+  fprintf(stderr,
+          "Analyzed %d positions in %.2f s with %d engines: %.1f "
+          "positions/s\n",
+          analysis.nextPosition, elapsed / 1000.0, concurrency,
+          analysis.nextPosition * 1000.0 / (elapsed > 0 ? elapsed : 1));
+  free(analysis.results);
+  if (analysis.input != stdin)
+    fclose(analysis.input);
+  pthread_mutex_destroy(&analysis.lock);
+  return 0;
+}
+
+typedef struct TraceEventInfo {
+  const char *name;
+  char phase;
+  const char *args; // Comma-separated argument names
+} TraceEventInfo;
+
+#define TRACE_INFO(id, name, phase, args) {name, phase, args},
+static const TraceEventInfo traceEvents[TRACE_EVENTS] = {
+    TRACE_EVENT_LIST(TRACE_INFO)};
+
+int compareTraceRecords(const void *a, const void *b) {
+  const TraceRecord *x = a, *y = b;
+  if (x->time != y->time)
+    return x->time < y->time ? -1 : 1;
+  return (x->thread > y->thread) - (x->thread < y->thread);
+}
+
+// Print the arguments of record as name=value pairs, or as JSON members
+void printTraceArgs(FILE *out, const TraceRecord *record, int json) {
+  const char *names = traceEvents[record->event].args;
+  for (int i = 0; *names && i < 5; i++) {
+    int len = (int)strcspn(names, ",");
+    int value = record->args[i];
+    char text[16];
+    if (len == 4 && strncmp(names, "cell", 4) == 0) {
+      char move[8] = "none";
+      if (value >= 0 && value < CELLS)
+        formatCell(value, move, sizeof(move));
+      snprintf(text, sizeof(text), json ? "\"%s\"" : "%s", move);
+    } else {
+      snprintf(text, sizeof(text), "%d", value);
     }
+    if (json)
+      fprintf(out, "%s\"%.*s\": %s", i ? ", " : "", len, names, text);
+    else
+      fprintf(out, " %.*s=%s", len, names, text);
+    names += len + (names[len] == ',');
   }
 }
 
-void drawGrid(int grid[N][M]) {
-  // Check if there's a winning sequence to highlight
-  int winMark[N][M];
-  int winner = findWinningSequence(grid, winMark);
+// Print the trace in path as text, one record per line, or as Chrome
+// trace-event JSON (chrome://tracing, Perfetto) with json
+int decodeTrace(const char *path, int json) {
+  FILE *in = fopen(path, "rb");
+  if (!in) {
+    perror("open trace");
+    return 1;
+  }
+  TraceHeader header;
+  if (fread(&header, sizeof(header), 1, in) != 1 ||
+      memcmp(header.magic, "ZGTRACE", 8) != 0 ||
+      header.version != TRACE_VERSION ||
+      header.recordSize != sizeof(TraceRecord)) {
+    fprintf(stderr, "%s is not a trace of this version\n", path);
+    fclose(in);
+    return 1;
+  }
+  if (header.variant != (uint32_t)(N << 16 | M << 8 | WIN_LENGTH)) {
+    fprintf(stderr, "%s was recorded on another board; decode it with "
+                    "--variant %dx%dx%d\n",
+            path, header.variant >> 16, header.variant >> 8 & 0xFF,
+            header.variant & 0xFF);
+    fclose(in);
+    return 1;
+  }
+  size_t count = 0, capacity = 1024;
+  TraceRecord *records = malloc(capacity * sizeof(TraceRecord));
+  while (fread(&records[count], sizeof(TraceRecord), 1, in) == 1) {
+    if (++count == capacity) {
+      capacity *= 2;
+      records = realloc(records, capacity * sizeof(TraceRecord));
+    }
+  }
+  fclose(in);
+  qsort(records, count, sizeof(TraceRecord), compareTraceRecords);
 
-  for (int j = 0; j < M && j < 26; j++) {
-    printf("%c ", 'A' + j);
+  // Ticks to time, from the first and the last clock records
+  uint64_t tick0 = 0, tick1 = 0;
+  long long ns0 = 0, ns1 = 0;
+  int clocks = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (records[i].event != TRACE_CLOCK)
+      continue;
+    long long ns = (long long)((uint64_t)(uint32_t)records[i].args[0] << 32 |
+                               (uint32_t)records[i].args[1]);
+    if (!clocks++) {
+      tick0 = records[i].time;
+      ns0 = ns;
+    }
+    tick1 = records[i].time;
+    ns1 = ns;
   }
-  printf("\n");
-  for (int i = 0; i < N; i++) {
-    printf(" %02d |", i + 1);
-    for (int j = 0; j < M; j++) {
-      if (grid[i][j] == 0) {
-        printf(" .");
-      } else {
-        // Determine color
-        const char *color;
-        if (winner && winMark[i][j]) {
-          // Winning piece: black on white
-          color = COLOR_BLACK_ON_WHITE;
-        } else if (grid[i][j] == 1) {
-          // Player X: red bold
-          color = COLOR_RED_BOLD;
-        } else {
-          // Player O (AI): green bold
-          color = COLOR_GREEN_BOLD;
-        }
+  double nsPerTick = tick1 > tick0 ? (double)(ns1 - ns0) / (tick1 - tick0) : 1;
 
-        char piece = grid[i][j] == 1 ? 'X' : 'O';
-        printf(" %s%c%s", color, piece, COLOR_RESET);
+  char names[TRACE_MAX_RINGS][16];
+  for (int i = 0; i < TRACE_MAX_RINGS; i++)
+    snprintf(names[i], sizeof(names[i]), "thread %d", i);
+
+  if (json)
+    printf("{\"traceEvents\": [");
+  int first = 1;
+  for (size_t i = 0; i < count; i++) {
+    const TraceRecord *record = &records[i];
+    if (record->event == TRACE_CLOCK || record->event >= TRACE_EVENTS ||
+        record->thread >= TRACE_MAX_RINGS)
+      continue;
+    const TraceEventInfo *info = &traceEvents[record->event];
+    double us = (double)(int64_t)(record->time - tick0) * nsPerTick / 1000;
+    if (record->event == TRACE_WORKER)
+      snprintf(names[record->thread], sizeof(names[record->thread]),
+               "worker %d", record->args[0]);
+
+    if (json) {
+      printf("%s\n  ", first ? "" : ",");
+      first = 0;
+      if (record->event == TRACE_WORKER) {
+        printf("{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+               "\"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+               record->thread, names[record->thread]);
+        continue;
       }
+      printf("{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, "
+             "\"tid\": %d, %s\"args\": {",
+             info->name, info->phase, us, record->thread,
+             info->phase == 'i' ? "\"s\": \"t\", " : "");
+      printTraceArgs(stdout, record, 1);
+      printf("}}");
+    } else if (record->event != TRACE_WORKER) {
+      printf("%12.3f ms  %-10s %s%s", us / 1000, names[record->thread],
+             info->name,
+             info->phase == 'B'   ? " begin"
+             : info->phase == 'E' ? " end"
+                                  : "");
+      printTraceArgs(stdout, record, 0);
+      printf("\n");
     }
-    printf("\n");
   }
+  if (json)
+    printf("\n]}\n");
+  free(records);
+  return 0;
 }
 
-void draw(void) {
-  printf("%s%s\n      ", CLEAR_SCREEN, REPOS_CURSOR);
-
-  drawGrid(game->grid);
+void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [depth] [options]\n"
+          "  depth           Search depth, 1-12 (default %d)\n"
+          "  --movetime MS   Think for MS milliseconds per move instead of "
+          "searching to a fixed depth\n"
+          "  --hash MB       Transposition table size in MB (default %d)\n"
+          "  --symmetry      Share TT entries between mirrored/rotated "
+          "positions\n"
+          "  --threads N     Search threads (default: one per online CPU)\n"
+          "  --pin           Pin each search thread to its own CPU\n"
+          "  --scaling       Print a thread scaling report and exit\n"
+          "  --engine        Speak a line protocol on stdin/stdout instead "
+          "of the terminal UI\n"
+          "  --bench         Search the benchmark positions to depth "
+          "(default %d) and exit\n"
+          "  --json          Print --bench results as JSON\n"
+          "  --selftest      Check the incremental evaluation and line "
+          "tests against full scans and exit\n"
+          "  --stats FILE    Append search statistics of every AI move to "
+          "FILE as JSON lines\n"
+          "  --match A B     Play engine configuration A against B, e.g. "
+          "--match depth=6 depth=5,radius=1\n"
+          "                  (keys: depth, movetime, threads, hash, radius, "
+          "symmetry, mcts)\n"
+          "  --games N       Games in a --match (default %d)\n"
+          "  --concurrency N Games played or positions analyzed at once "
+          "(default: CPUs / threads)\n"
+          "  --sprt E0 E1    SPRT hypotheses in Elo (default 0 5)\n"
+          "  --radius R      Only consider cells within R (1-2) of a stone "
+          "(default %d)\n"
+          "  --no-simd       Use the scalar evaluation and line kernels even "
+          "if the CPU has AVX2\n"
+          "  --ponder        Search the replies to your moves while you "
+          "think\n"
+          "  --mcts          Search with Monte Carlo tree search instead of "
+          "alpha-beta\n"
+          "  --book FILE     Play the first moves from an opening book\n"
+          "  --cache FILE    Keep search results in FILE across sessions\n"
+          "  --trace FILE    Record a timeline of the search threads in "
+          "FILE\n"
+          "  --decode-trace FILE  Print a trace as text, or with --json as "
+          "Chrome trace events\n"
+          "  --analyze FILE  Search each position in FILE (- for stdin), "
+          "one per line, and print the results in order\n"
+          "  --build-book FILE  Search the opening positions to depth "
+          "(default %d) and write the book to FILE\n"
+          "  --variant V     Board variant, rows x columns x line length: "
+          "%s",
+          prog, DEFAULT_DEPTH, DEFAULT_HASH_MB, BENCH_DEPTH, MATCH_GAMES,
+          DEFAULT_RADIUS, BOOK_DEPTH, VARIANT_NAME " (default)");
+#if defined(VARIANTS) && !defined(VARIANT_ENTRY)
+#define VARIANT_USAGE(n, m, l) fprintf(stderr, ", " #n "x" #m "x" #l);
+  VARIANT_LIST(VARIANT_USAGE)
+#endif
+  fprintf(stderr, "\n");
+}
 
-  printf("\n");
+#ifdef VARIANT_ENTRY
+// Built as an extra variant: the default build's main() calls this one
+#define main VARIANT_ENTRY
+#elif defined(VARIANTS)
+#define VARIANT_DECLARE(n, m, l) int main_##n##x##m##x##l(int, char **);
+VARIANT_LIST(VARIANT_DECLARE)
 
-  if (game->won) {
-    printf("You %s\nPress <Enter> to play again.",
-           game->won == 1 ? "won!" : "lose...");
-    fflush(stdout);
-  } else if (game->aiThinking) {
-    int adaptiveDepth = getAdaptiveDepth(game->moveNo);
-    printf("AI thinking (depth %d, %d threads)...\n", adaptiveDepth,
-           NUM_THREADS);
-  } else {
-    // Draw input buf
-    printf("Your move: %s\n",
-           game->invalidMove
-               ? "Invalid move, cell alreay set or out of bound."
-               : (game->failedInput ? "Invalid input" : game->input));
-    int adaptiveDepth = getAdaptiveDepth(game->moveNo);
-    printf("AI search depth: %d (adaptive, max: %d)\n", adaptiveDepth,
-           game->searchDepth);
-  }
+// Hand the whole command line to the entry point of the named variant
+int runVariant(const char *name, int argc, char *argv[]) {
+#define VARIANT_RUN(n, m, l)                                                   \
+  if (strcmp(name, #n "x" #m "x" #l) == 0)                                     \
+    return main_##n##x##m##x##l(argc, argv);
+  VARIANT_LIST(VARIANT_RUN)
+  fprintf(stderr, "Unknown variant %s\n", name);
+  usage(argv[0]);
+  return 1;
+}
+#else
+int runVariant(const char *name, int argc, char *argv[]) {
+  (void)argc;
+  fprintf(stderr, "Variant %s is not built in\n", name);
+  usage(argv[0]);
+  return 1;
 }
+#endif
 
 int main(int argc, char *argv[]) {
-  setup();
+  int scaling = 0;
+  int engineMode = 0;
+  int bench = 0;
+  int selftest = 0;
+  int json = 0;
+  int depthGiven = 0;
+  const char *buildBookFile = NULL;
+  const char *analyzeFile = NULL;
+  const char *decodeFile = NULL;
+  const char *matchA = NULL, *matchB = NULL;
+  int games = MATCH_GAMES;
+  int concurrency = 0;
+  double elo0 = 0, elo1 = 5;
+
+#ifndef VARIANT_ENTRY
+  for (int i = 1; i + 1 < argc; i++) {
+    if (strcmp(argv[i], "--variant") == 0 &&
+        strcmp(argv[i + 1], VARIANT_NAME) != 0)
+      return runVariant(argv[i + 1], argc, argv);
+  }
+#endif
 
-  if (argc > 1) {
-    int depth = atoi(argv[1]);
-    if (depth > 0 && depth <= 12) {
-      game->searchDepth = depth;
-      llog("Search depth set to %d\n", depth);
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      int threads = atoi(argv[++i]);
+      if (threads < 1 || threads > MAX_THREADS) {
+        fprintf(stderr, "Invalid thread count. Valid range: 1-%d\n",
+                MAX_THREADS);
+        return 1;
+      }
+      opts.threads = threads;
+    } else if (strcmp(argv[i], "--pin") == 0) {
+      opts.pin = 1;
+    } else if (strcmp(argv[i], "--scaling") == 0) {
+      scaling = 1;
+    } else if (strcmp(argv[i], "--engine") == 0) {
+      engineMode = 1;
+    } else if (strcmp(argv[i], "--bench") == 0) {
+      bench = 1;
+    } else if (strcmp(argv[i], "--selftest") == 0) {
+      selftest = 1;
+    } else if (strcmp(argv[i], "--json") == 0) {
+      json = 1;
+    } else if (strcmp(argv[i], "--no-simd") == 0) {
+      opts.noSimd = 1;
+    } else if (strcmp(argv[i], "--ponder") == 0) {
+      opts.ponder = 1;
+    } else if (strcmp(argv[i], "--mcts") == 0) {
+      opts.mcts = 1;
+    } else if (strcmp(argv[i], "--book") == 0 && i + 1 < argc) {
+      initBitboards(); // The book's keys are checked against the Zobrist keys
+      if (!bookOpen(argv[++i]))
+        return 1;
+    } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+      initBitboards(); // The header is checked against the evaluation
+      if (!cacheOpen(argv[++i]))
+        return 1;
+    } else if (strcmp(argv[i], "--build-book") == 0 && i + 1 < argc) {
+      buildBookFile = argv[++i];
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      if (!traceOpen(argv[++i]))
+        return 1;
+    } else if (strcmp(argv[i], "--decode-trace") == 0 && i + 1 < argc) {
+      decodeFile = argv[++i];
+    } else if (strcmp(argv[i], "--analyze") == 0 && i + 1 < argc) {
+      analyzeFile = argv[++i];
+    } else if (strcmp(argv[i], "--variant") == 0 && i + 1 < argc) {
+      i++; // Picked above
+    } else if (strcmp(argv[i], "--match") == 0 && i + 2 < argc) {
+      matchA = argv[++i];
+      matchB = argv[++i];
+    } else if (strcmp(argv[i], "--games") == 0 && i + 1 < argc) {
+      games = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--concurrency") == 0 && i + 1 < argc) {
+      concurrency = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--sprt") == 0 && i + 2 < argc) {
+      elo0 = atof(argv[++i]);
+      elo1 = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+      opts.statsFile = fopen(argv[++i], "a");
+      if (!opts.statsFile) {
+        perror("open stats file");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--hash") == 0 && i + 1 < argc) {
+      int mb = atoi(argv[++i]);
+      if (mb < 1 || mb > 65536) {
+        fprintf(stderr, "Invalid hash size. Valid range: 1-65536 MB\n");
+        return 1;
+      }
+      opts.hashMb = mb;
+    } else if (strcmp(argv[i], "--movetime") == 0 && i + 1 < argc) {
+      int ms = atoi(argv[++i]);
+      if (ms < 1) {
+        fprintf(stderr, "Invalid move time. Must be at least 1 ms\n");
+        return 1;
+      }
+      opts.moveTimeMs = ms;
+    } else if (strcmp(argv[i], "--radius") == 0 && i + 1 < argc) {
+      int radius = atoi(argv[++i]);
+      if (radius < 1 || radius > 2) {
+        fprintf(stderr, "Invalid radius. Valid range: 1-2\n");
+        return 1;
+      }
+      opts.radius = radius;
+    } else if (strcmp(argv[i], "--symmetry") == 0) {
+      opts.symmetry = 1;
+    } else if (argv[i][0] != '-') {
+      int depth = atoi(argv[i]);
+      if (depth > 0 && depth <= 12) {
+        opts.searchDepth = depth;
+        depthGiven = 1;
+      } else {
+        printf("Invalid depth. Using default depth %d. Valid range: 1-12\n",
+               DEFAULT_DEPTH);
+        // Wait to show message
+        sleep(2);
+      }
     } else {
-      printf("Invalid depth. Using default depth %d. Valid range: 1-12\n",
-             DEFAULT_DEPTH);
-      // Wait to show message
-      sleep(2);
+      usage(argv[0]);
+      return 1;
     }
   }
 
-  while (1) {
+  if (decodeFile)
+    return decodeTrace(decodeFile, json);
+  if (scaling) {
+    scalingReport();
+    return 0;
+  }
+  if (engineMode) {
+    engineLoop();
+    return 0;
+  }
+  if (bench) {
+    benchmark(depthGiven ? opts.searchDepth : BENCH_DEPTH, json);
+    return 0;
+  }
+  if (selftest)
+    return selfTest(SELFTEST_GAMES);
+  if (buildBookFile)
+    return buildBook(buildBookFile, depthGiven ? opts.searchDepth : BOOK_DEPTH);
+  if (analyzeFile)
+    return runAnalysis("/proc/self/exe", analyzeFile, concurrency);
+  if (matchA) {
+    return runMatch("/proc/self/exe", matchA, matchB, games, concurrency, elo0,
+                    elo1);
+  }
+
+  setup();
+
+  while (!quitRequested) {
     update();
     draw();
-    usleep(16666); // ~60 FPS (1/60 second = 16.666ms)
+    waitForEvent();
   }
+  return 0;
 }